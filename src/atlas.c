@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ *
+ * Pack rectangles into a fixed size area
+ * Uses the skyline bottom-left heuristic: the area is described by the
+ * upper edge of everything placed so far, a rectangle goes where this edge
+ * would end up the lowest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "atlas.h"
+
+/* horizontal piece of the skyline */
+typedef struct segment {
+	int x, y, w;
+} Segment;
+
+struct atlas {
+	int w, h;
+	Segment *sky; /* sorted by `x', covering the whole width */
+	size_t n, cap;
+};
+
+static int atlas_fit(const Atlas *, size_t, int, int);
+
+
+Atlas *
+atlas_create(int w, int h)
+{
+	Atlas *a;
+
+	if (w <= 0 || h <= 0) {
+		LOG_ERROR("invalid atlas size %dx%d", w, h);
+		return NULL;
+	}
+	a = malloc(sizeof(Atlas));
+	if (!a)
+		return NULL;
+	/* every segment is at least one unit wide */
+	a->cap = w + 1;
+	a->sky = malloc(sizeof(Segment) * a->cap);
+	if (!a->sky) {
+		free(a);
+		return NULL;
+	}
+	a->w = w;
+	a->h = h;
+	a->n = 1;
+	a->sky[0].x = a->sky[0].y = 0;
+	a->sky[0].w = w;
+
+	return a;
+}
+
+void
+atlas_destroy(Atlas *a)
+{
+	free(a->sky);
+	free(a);
+}
+
+/**
+ * Find place for a `w' by `h' rectangle
+ * Returns 0 if the atlas has no more room for it
+ */
+int
+atlas_pack(Atlas *a, int w, int h, int *x, int *y)
+{
+	size_t i, best, n;
+	int top, besty, bestw, right;
+
+	if (w <= 0 || h <= 0)
+		return 0;
+	best = a->n;
+	besty = a->h;
+	bestw = a->w;
+	for (i = 0; i < a->n; ++i) {
+		if ((top = atlas_fit(a, i, w, h)) < 0)
+			continue;
+		if (top < besty || (top == besty && a->sky[i].w < bestw)) {
+			best = i;
+			besty = top;
+			bestw = a->sky[i].w;
+		}
+	}
+	if (best == a->n)
+		return 0;
+	*x = a->sky[best].x;
+	*y = besty;
+
+	/* raise the skyline over the new rectangle */
+	right = *x + w;
+	memmove(&a->sky[best + 1], &a->sky[best], sizeof(Segment) * (a->n - best));
+	++a->n;
+	a->sky[best].y = besty + h;
+	a->sky[best].w = w;
+	for (i = best + 1; i < a->n && a->sky[i].x < right; ) {
+		if (a->sky[i].x + a->sky[i].w <= right) {
+			memmove(&a->sky[i], &a->sky[i + 1], sizeof(Segment) * (a->n - i - 1));
+			--a->n;
+			continue;
+		}
+		a->sky[i].w -= right - a->sky[i].x;
+		a->sky[i].x = right;
+		break;
+	}
+	/* merge neighbours of the same height */
+	for (i = n = 0; i < a->n; ++i) {
+		if (n && a->sky[n - 1].y == a->sky[i].y)
+			a->sky[n - 1].w += a->sky[i].w;
+		else
+			a->sky[n++] = a->sky[i];
+	}
+	a->n = n;
+
+	return 1;
+}
+
+/**
+ * Get height at which a `w' by `h' rectangle placed at the start of
+ * segment `i' would rest, or -1 if it does not fit
+ */
+static int
+atlas_fit(const Atlas *a, size_t i, int w, int h)
+{
+	int top, left;
+
+	if (a->sky[i].x + w > a->w)
+		return -1;
+	top = 0;
+	for (left = w; left > 0; ++i) {
+		top = a->sky[i].y > top ? a->sky[i].y : top;
+		if (top + h > a->h)
+			return -1;
+		left -= a->sky[i].w;
+	}
+
+	return top;
+}
@@ -0,0 +1,453 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Lists of drawing commands recorded for a later frame
+ * Commands are kept in one growing array and printed text along with other
+ * copied data in another, both reused from frame to frame. Queries made
+ * while recording, such as visibility, go by the camera recorded last
+ * rather than by the one the context has at the time, which belongs to
+ * whichever frame is replayed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "ff.h"
+#include "render.h"
+#include "cmdlist.h"
+
+#define DATA_ALIGN 16 /* of copied data other than text */
+
+enum cmd_op {
+	CMD_CLEAR,
+	CMD_SET_CAMERA,
+	CMD_RESET_CAMERA,
+	CMD_SET_DEPTH_TEST,
+	CMD_BATCH_BEGIN,
+	CMD_BATCH_PUSH,
+	CMD_BATCH_FLUSH,
+	CMD_QUEUE_PUSH,
+	CMD_QUEUE_SUBMIT,
+	CMD_PRINT,
+	CMD_DRAW_CACHED,
+	CMD_INVALIDATE_CACHE,
+	CMD_UPDATE
+};
+
+typedef struct {
+	enum cmd_op op;
+	union {
+		struct {
+			int sprite, x, y, z, ox, oy;
+		} draw;
+		struct {
+			int sprite, x, y, z;
+			size_t s, len; /* offset into `data' */
+		} print;
+		struct {
+			unsigned long key;
+			int z, x0, y0, x1, y1;
+		} cache;
+		struct {
+			unsigned long key;
+			int z;
+			void (*fn)(Gc *, int, int, int, int, int, void *);
+			void *ctx;
+		} cached;
+		struct {
+			void (*fn)(void *, const void *, size_t);
+			void *ctx;
+			size_t s, len; /* offset into `data' */
+		} update;
+		Camera cam;
+		int on;
+	} u;
+} Cmd;
+
+struct cmd_list {
+	const Gc *gc; /* for sprite sizes, which stay put once loaded */
+	Cmd *cmds;
+	size_t n, cap;
+	char *data;
+	size_t ndata, capdata;
+	Camera cam; /* recorded last */
+	int failed; /* commands were dropped for lack of memory */
+};
+
+static Cmd * cmd_push(CmdList *, enum cmd_op);
+static char * cmd_reserve(CmdList *, size_t);
+
+
+CmdList *
+cmdlist_create(const Gc *gc)
+{
+	CmdList *l;
+
+	if (!(l = calloc(sizeof(CmdList), 1))) {
+		LOG_PERROR("failed to allocate command list");
+		return NULL;
+	}
+	l->gc = gc;
+	l->cam.zoom = 1.f;
+
+	return l;
+}
+
+void
+cmdlist_destroy(CmdList *l)
+{
+	free(l->cmds);
+	free(l->data);
+	free(l);
+}
+
+/**
+ * Empty the list for the next frame, keeping its storage
+ */
+void
+cmdlist_reset(CmdList *l)
+{
+	l->n = l->ndata = 0;
+	l->cam.x = l->cam.y = 0;
+	l->cam.zoom = 1.f;
+	l->failed = 0;
+}
+
+size_t
+cmdlist_size(const CmdList *l)
+{
+	return l->n;
+}
+
+/**
+ * Issue the recorded commands to `gc'
+ */
+void
+cmdlist_replay(const CmdList *l, Gc *gc)
+{
+	size_t i;
+	const Cmd *c;
+
+	for (i = 0; i < l->n; ++i) {
+		c = &l->cmds[i];
+		switch (c->op) {
+		case CMD_CLEAR:
+			gc_clear(gc);
+			break;
+		case CMD_SET_CAMERA:
+			gc_set_camera(gc, &c->u.cam);
+			break;
+		case CMD_RESET_CAMERA:
+			gc_set_camera(gc, NULL);
+			break;
+		case CMD_SET_DEPTH_TEST:
+			gc_set_depth_test(gc, c->u.on);
+			break;
+		case CMD_BATCH_BEGIN:
+			gc_batch_begin(gc);
+			break;
+		case CMD_BATCH_PUSH:
+			gc_batch_push(gc, c->u.draw.sprite, c->u.draw.x, c->u.draw.y,
+				c->u.draw.z, c->u.draw.ox, c->u.draw.oy);
+			break;
+		case CMD_BATCH_FLUSH:
+			gc_batch_flush(gc);
+			break;
+		case CMD_QUEUE_PUSH:
+			gc_queue_push(gc, c->u.draw.sprite, c->u.draw.x, c->u.draw.y,
+				c->u.draw.z, c->u.draw.ox, c->u.draw.oy);
+			break;
+		case CMD_QUEUE_SUBMIT:
+			gc_queue_submit(gc);
+			break;
+		case CMD_PRINT:
+			gc_print(gc, c->u.print.sprite, c->u.print.x, c->u.print.y,
+				c->u.print.z, l->data + c->u.print.s, c->u.print.len);
+			break;
+		case CMD_DRAW_CACHED:
+			gc_draw_cached(gc, c->u.cached.key, c->u.cached.z,
+				c->u.cached.fn, c->u.cached.ctx);
+			break;
+		case CMD_INVALIDATE_CACHE:
+			gc_invalidate_cache(gc, c->u.cache.key, c->u.cache.z,
+				c->u.cache.x0, c->u.cache.y0, c->u.cache.x1, c->u.cache.y1);
+			break;
+		case CMD_UPDATE:
+			c->u.update.fn(c->u.update.ctx, l->data + c->u.update.s,
+				c->u.update.len);
+			break;
+		}
+	}
+}
+
+void
+cmd_clear(CmdList *l)
+{
+	cmd_push(l, CMD_CLEAR);
+}
+
+void
+cmd_set_camera(CmdList *l, const Camera *cam)
+{
+	Cmd *c;
+
+	if (!cam) {
+		l->cam.x = l->cam.y = 0;
+		l->cam.zoom = 1.f;
+		cmd_push(l, CMD_RESET_CAMERA);
+		return;
+	}
+	l->cam = *cam;
+	if (l->cam.zoom <= 0.f)
+		l->cam.zoom = 1.f;
+	if ((c = cmd_push(l, CMD_SET_CAMERA)))
+		c->u.cam = *cam;
+}
+
+/**
+ * Get the area visible through the camera recorded last
+ */
+void
+cmd_get_view(const CmdList *l, int *x0, int *y0, int *x1, int *y1)
+{
+	int w, h;
+
+	gc_get_size(l->gc, &w, &h);
+	*x0 = l->cam.x;
+	*y0 = l->cam.y;
+	*x1 = l->cam.x + (int)(2 * w / l->cam.zoom);
+	*y1 = l->cam.y + (int)(2 * h / l->cam.zoom);
+}
+
+/**
+ * Check whether a sprite drawn at `x', `y' would end up on the screen
+ */
+int
+cmd_visible(const CmdList *l, int sprite, int x, int y)
+{
+	int x0, y0, x1, y1, sw, sh;
+
+	cmd_get_view(l, &x0, &y0, &x1, &y1);
+	gc_sprite_size(l->gc, sprite, &sw, &sh);
+	return x + sw > x0 && x - sw < x1 && y + sh > y0 && y - sh < y1;
+}
+
+void
+cmd_sprite_size(const CmdList *l, int sprite, int *w, int *h)
+{
+	gc_sprite_size(l->gc, sprite, w, h);
+}
+
+void
+cmd_set_depth_test(CmdList *l, int on)
+{
+	Cmd *c;
+
+	if ((c = cmd_push(l, CMD_SET_DEPTH_TEST)))
+		c->u.on = on;
+}
+
+void
+cmd_batch_begin(CmdList *l)
+{
+	cmd_push(l, CMD_BATCH_BEGIN);
+}
+
+void
+cmd_batch_push(CmdList *l, int sprite, int x, int y, int z, int ox, int oy)
+{
+	Cmd *c;
+
+	if (!(c = cmd_push(l, CMD_BATCH_PUSH)))
+		return;
+	c->u.draw.sprite = sprite;
+	c->u.draw.x = x;
+	c->u.draw.y = y;
+	c->u.draw.z = z;
+	c->u.draw.ox = ox;
+	c->u.draw.oy = oy;
+}
+
+void
+cmd_batch_flush(CmdList *l)
+{
+	cmd_push(l, CMD_BATCH_FLUSH);
+}
+
+void
+cmd_queue_push(CmdList *l, int sprite, int x, int y, int z, int ox, int oy)
+{
+	Cmd *c;
+
+	if (!(c = cmd_push(l, CMD_QUEUE_PUSH)))
+		return;
+	c->u.draw.sprite = sprite;
+	c->u.draw.x = x;
+	c->u.draw.y = y;
+	c->u.draw.z = z;
+	c->u.draw.ox = ox;
+	c->u.draw.oy = oy;
+}
+
+void
+cmd_queue_submit(CmdList *l)
+{
+	cmd_push(l, CMD_QUEUE_SUBMIT);
+}
+
+/**
+ * Record printing of a string; it is copied, so it may change afterwards
+ */
+void
+cmd_print(CmdList *l, int sprite, int x, int y, int z, const char *s, size_t len)
+{
+	Cmd *c;
+	char *text;
+
+	if (!len)
+		len = strlen(s);
+	if (!(text = cmd_reserve(l, len)) || !(c = cmd_push(l, CMD_PRINT)))
+		return;
+	memcpy(text, s, len);
+	c->u.print.sprite = sprite;
+	c->u.print.x = x;
+	c->u.print.y = y;
+	c->u.print.z = z;
+	c->u.print.s = l->ndata;
+	c->u.print.len = len;
+	l->ndata += len;
+}
+
+/**
+ * Record drawing of a cached layer
+ * `fn' runs where the list is replayed, possibly on another thread while
+ * the next frame is being recorded, so it must only read data that is
+ * left alone meanwhile
+ */
+void
+cmd_draw_cached(CmdList *l, unsigned long key, int z,
+	void (*fn)(Gc *, int, int, int, int, int, void *), void *ctx)
+{
+	Cmd *c;
+
+	if (!(c = cmd_push(l, CMD_DRAW_CACHED)))
+		return;
+	c->u.cached.key = key;
+	c->u.cached.z = z;
+	c->u.cached.fn = fn;
+	c->u.cached.ctx = ctx;
+}
+
+/**
+ * Record a call of `fn' with a copy of `len' bytes of `data'
+ * This hands state read by cached layers over to where the list is
+ * replayed, in order with the frames showing it
+ */
+void
+cmd_update(CmdList *l, void (*fn)(void *, const void *, size_t), void *ctx,
+	const void *data, size_t len)
+{
+	Cmd *c;
+	char *copy;
+
+	l->ndata = (l->ndata + DATA_ALIGN - 1) / DATA_ALIGN * DATA_ALIGN;
+	if (!(copy = cmd_reserve(l, len)) || !(c = cmd_push(l, CMD_UPDATE)))
+		return;
+	memcpy(copy, data, len);
+	c->u.update.fn = fn;
+	c->u.update.ctx = ctx;
+	c->u.update.s = l->ndata;
+	c->u.update.len = len;
+	l->ndata += len;
+}
+
+void
+cmd_invalidate_cache(CmdList *l, unsigned long key, int z, int x0, int y0, int x1, int y1)
+{
+	Cmd *c;
+
+	if (!(c = cmd_push(l, CMD_INVALIDATE_CACHE)))
+		return;
+	c->u.cache.key = key;
+	c->u.cache.z = z;
+	c->u.cache.x0 = x0;
+	c->u.cache.y0 = y0;
+	c->u.cache.x1 = x1;
+	c->u.cache.y1 = y1;
+}
+
+/**
+ * Append a command, growing the list when full
+ * The first failure to grow is logged; the frame goes on without the
+ * commands that did not fit
+ */
+static Cmd *
+cmd_push(CmdList *l, enum cmd_op op)
+{
+	Cmd *cmds;
+	size_t cap;
+
+	if (l->n == l->cap) {
+		cap = l->cap ? l->cap * 2 : 1024;
+		if (!(cmds = realloc(l->cmds, sizeof(Cmd) * cap))) {
+			if (!l->failed)
+				LOG_ERROR("failed to grow command list to %zu commands", cap);
+			l->failed = 1;
+			return NULL;
+		}
+		l->cmds = cmds;
+		l->cap = cap;
+	}
+	l->cmds[l->n].op = op;
+	return &l->cmds[l->n++];
+}
+
+/**
+ * Make room for `len' more bytes of copied data, growing it when full
+ */
+static char *
+cmd_reserve(CmdList *l, size_t len)
+{
+	char *data;
+	size_t cap;
+
+	if (l->ndata + len > l->capdata) {
+		cap = l->capdata ? l->capdata : 256;
+		while (cap < l->ndata + len)
+			cap *= 2;
+		if (!(data = realloc(l->data, cap))) {
+			if (!l->failed)
+				LOG_ERROR("failed to grow command list data to %zu bytes", cap);
+			l->failed = 1;
+			return NULL;
+		}
+		l->data = data;
+		l->capdata = cap;
+	}
+	return l->data + l->ndata;
+}
@@ -0,0 +1,53 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Lists of drawing commands recorded for a later frame
+ * Commands mirror the `gc_' calls they stand for, save for updates handing
+ * copied state over; a list recorded on one thread may be replayed on
+ * another owning the graphical context
+ */
+
+typedef struct cmd_list CmdList;
+
+CmdList * cmdlist_create(const Gc *);
+void cmdlist_destroy(CmdList *);
+void cmdlist_reset(CmdList *);
+size_t cmdlist_size(const CmdList *);
+void cmdlist_replay(const CmdList *, Gc *);
+void cmd_clear(CmdList *);
+void cmd_set_camera(CmdList *, const Camera *);
+void cmd_get_view(const CmdList *, int *, int *, int *, int *);
+int cmd_visible(const CmdList *, int, int, int);
+void cmd_sprite_size(const CmdList *, int, int *, int *);
+void cmd_set_depth_test(CmdList *, int);
+void cmd_batch_begin(CmdList *);
+void cmd_batch_push(CmdList *, int, int, int, int, int, int);
+void cmd_batch_flush(CmdList *);
+void cmd_queue_push(CmdList *, int, int, int, int, int, int);
+void cmd_queue_submit(CmdList *);
+void cmd_print(CmdList *, int, int, int, int, const char *, size_t);
+void cmd_draw_cached(CmdList *, unsigned long, int, void (*)(Gc *, int, int, int, int, int, void *), void *);
+void cmd_invalidate_cache(CmdList *, unsigned long, int, int, int, int, int);
+void cmd_update(CmdList *, void (*)(void *, const void *, size_t), void *, const void *, size_t);
@@ -0,0 +1,644 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ *
+ * Detect collisions of axis-aligned boxes
+ * Boxes are added anew on every update and sorted into buckets of a uniform
+ * spatial hash, so only boxes sharing a grid cell are ever tested against
+ * each other. Overlaps are compared with the previous update to tell apart
+ * entering, staying and exiting pairs, which are passed to handlers in
+ * batches.
+ * Static boxes are kept across updates in a bounding volume hierarchy that
+ * is rebuilt only after they change; they are tested against the other
+ * boxes only, never against each other.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "collision.h"
+
+#define MAX_HANDLERS 64
+#define NEVENTS 3
+#define INIT_CAP 64
+#define MIN_BUCKETS 16
+#define BVH_LEAF 4 /* max boxes in a leaf of the static tree */
+#define BVH_STACK 128 /* nodes pending in a query; more than the tree has levels */
+
+typedef struct body {
+	int id, x, y, w, h;
+	uint32_t layer, mask;
+} Body;
+
+/* node of the static tree; leaves hold `n' boxes starting at `first',
+ * inner nodes have `n' set to 0 and children at `first' and `first + 1' */
+typedef struct node {
+	int x0, y0, x1, y1;
+	size_t first, n;
+} Node;
+
+/* overlapping boxes; `a' is always the lower id */
+typedef struct pair {
+	int a, b;
+	uint32_t la, lb;
+} Pair;
+
+typedef struct pairs {
+	Pair *d;
+	size_t n, cap;
+} Pairs;
+
+struct collisions {
+	int cell; /* edge of a grid cell */
+	Body *bodies;
+	size_t nbodies, bodycap;
+	Body *statics;
+	size_t nstatics, staticcap;
+	Node *nodes;
+	size_t nnodes, nodecap;
+	int dirty; /* statics changed since the tree was built */
+	/* spatial hash; `sorted' holds body indices grouped by bucket,
+	 * bucket `i' spans from `start[i]' up to `start[i + 1]' */
+	uint32_t *hash, *body, *sorted;
+	size_t entrycap;
+	size_t *start;
+	size_t bucketcap;
+	Pairs prev, cur, events[NEVENTS];
+	CollisionPair *batch;
+	size_t batchcap;
+	struct {
+		uint32_t layer, other;
+		int events;
+		void (*fn)(enum collision_event, const CollisionPair *, size_t, void *);
+		void *ctx;
+	} handlers[MAX_HANDLERS];
+	size_t nhandlers;
+};
+
+static void * reserve(void *, size_t *, size_t, size_t);
+static int bodies_push(Body **, size_t *, size_t *, int, int, int, int, int, uint32_t, uint32_t);
+static int overlap(const Body *, const Body *);
+static int collide(Collisions *, const Body *, const Body *);
+static int center_cmp_x(const void *, const void *);
+static int center_cmp_y(const void *, const void *);
+static size_t bvh_split(Collisions *, size_t, size_t, size_t);
+static int bvh_build(Collisions *);
+static int bvh_query(Collisions *, const Body *);
+static int pairs_push(Pairs *, int, int, uint32_t, uint32_t);
+static int pair_cmp(const void *, const void *);
+static int cell_of(int, int);
+static uint32_t cell_hash(int, int, size_t);
+static int detect(Collisions *);
+static void diff(Collisions *);
+static void dispatch(Collisions *);
+
+
+/**
+ * Create a collision world using a spatial hash of `cell' sized cells
+ * Cells should be about the size of a typical box
+ */
+Collisions *
+collisions_create(int cell)
+{
+	Collisions *c;
+
+	if (cell <= 0) {
+		LOG_ERROR("invalid collision cell size %d", cell);
+		return NULL;
+	}
+	c = calloc(sizeof(Collisions), 1);
+	if (!c) {
+		LOG_ERROR("failed allocating collision world");
+		return NULL;
+	}
+	c->cell = cell;
+
+	return c;
+}
+
+void
+collisions_destroy(Collisions *c)
+{
+	int i;
+
+	free(c->bodies);
+	free(c->statics);
+	free(c->nodes);
+	free(c->hash);
+	free(c->body);
+	free(c->sorted);
+	free(c->start);
+	free(c->prev.d);
+	free(c->cur.d);
+	for (i = 0; i < NEVENTS; ++i)
+		free(c->events[i].d);
+	free(c->batch);
+	free(c);
+}
+
+/**
+ * Register a handler of `events' for pairs of boxes on `layer' and `other'
+ * layers. Pairs are passed with the box on `layer' first; a handler gets all
+ * the pairs of a single event type at once.
+ */
+int
+collisions_handle(Collisions *c, uint32_t layer, uint32_t other, int events,
+	void (*fn)(enum collision_event, const CollisionPair *, size_t, void *), void *ctx)
+{
+	size_t i;
+
+	if (c->nhandlers >= MAX_HANDLERS) {
+		LOG_ERROR("reached limit of collision handlers (%d)", MAX_HANDLERS);
+		return -1;
+	}
+	i = c->nhandlers++;
+	c->handlers[i].layer = layer;
+	c->handlers[i].other = other;
+	c->handlers[i].events = events;
+	c->handlers[i].fn = fn;
+	c->handlers[i].ctx = ctx;
+	LOG_TRACE("added collision handler #%zu (%#x vs %#x)", i, layer, other);
+
+	return i;
+}
+
+/**
+ * Add a box to be tested on the next update
+ * Box on `layer' collides with boxes whose layer is in its `mask', or
+ * whose mask contains its `layer'
+ */
+int
+collisions_add(Collisions *c, int id, int x, int y, int w, int h, uint32_t layer, uint32_t mask)
+{
+	if (!layer && !mask)
+		return 0;
+	if (!bodies_push(&c->bodies, &c->nbodies, &c->bodycap, id, x, y, w, h, layer, mask)) {
+		LOG_ERROR("failed adding collision box of #%d", id);
+		return -1;
+	}
+
+	return 1;
+}
+
+/**
+ * Add a box that stays in place until `collisions_clear_static'
+ */
+int
+collisions_add_static(Collisions *c, int id, int x, int y, int w, int h, uint32_t layer, uint32_t mask)
+{
+	if (!layer && !mask)
+		return 0;
+	if (!bodies_push(&c->statics, &c->nstatics, &c->staticcap, id, x, y, w, h, layer, mask)) {
+		LOG_ERROR("failed adding static collision box of #%d", id);
+		return -1;
+	}
+	c->dirty = 1;
+
+	return 1;
+}
+
+void
+collisions_clear_static(Collisions *c)
+{
+	c->nstatics = 0;
+	c->dirty = 1;
+}
+
+/**
+ * Find overlapping boxes, run handlers and start collecting boxes anew
+ */
+void
+collisions_update(Collisions *c)
+{
+	Pairs tmp;
+	int ok;
+
+	ok = detect(c);
+	/* handlers may add boxes for the next update */
+	c->nbodies = 0;
+	if (!ok) {
+		LOG_ERROR("failed detecting collisions");
+		return;
+	}
+	diff(c);
+	tmp = c->prev;
+	c->prev = c->cur;
+	c->cur = tmp;
+	c->cur.n = 0;
+	dispatch(c);
+}
+
+/**
+ * Make sure an array at `p' fits `n' elements
+ * Returns the (possibly moved) array or NULL on failure
+ */
+static void *
+reserve(void *p, size_t *cap, size_t n, size_t size)
+{
+	size_t z;
+
+	if (p && n <= *cap)
+		return p;
+	z = *cap ? *cap : INIT_CAP;
+	while (z < n)
+		z *= 2;
+	p = realloc(p, size * z);
+	if (p)
+		*cap = z;
+
+	return p;
+}
+
+static int
+bodies_push(Body **d, size_t *n, size_t *cap, int id, int x, int y, int w, int h, uint32_t layer, uint32_t mask)
+{
+	Body *b;
+
+	if (!(b = reserve(*d, cap, *n + 1, sizeof(Body))))
+		return 0;
+	*d = b;
+	b = &b[(*n)++];
+	b->id = id;
+	b->x = x;
+	b->y = y;
+	b->w = w > 0 ? w : 1;
+	b->h = h > 0 ? h : 1;
+	b->layer = layer;
+	b->mask = mask;
+
+	return 1;
+}
+
+static int
+pairs_push(Pairs *p, int a, int b, uint32_t la, uint32_t lb)
+{
+	Pair *d;
+
+	if (!(d = reserve(p->d, &p->cap, p->n + 1, sizeof(Pair))))
+		return 0;
+	p->d = d;
+	d = &p->d[p->n++];
+	d->a = a;
+	d->b = b;
+	d->la = la;
+	d->lb = lb;
+
+	return 1;
+}
+
+static int
+pair_cmp(const void *p, const void *q)
+{
+	const Pair *a, *b;
+
+	a = p;
+	b = q;
+	if (a->a != b->a)
+		return a->a < b->a ? -1 : 1;
+	if (a->b != b->b)
+		return a->b < b->b ? -1 : 1;
+	return 0;
+}
+
+static int
+overlap(const Body *a, const Body *b)
+{
+	return a->x < b->x + b->w && a->x + a->w > b->x
+		&& a->y < b->y + b->h && a->y + a->h > b->y;
+}
+
+/**
+ * Record a pair of boxes if they overlap and their layers collide
+ */
+static int
+collide(Collisions *c, const Body *a, const Body *b)
+{
+	if (a == b || !(a->mask & b->layer || b->mask & a->layer) || !overlap(a, b))
+		return 1;
+	return a->id < b->id
+		? pairs_push(&c->cur, a->id, b->id, a->layer, b->layer)
+		: pairs_push(&c->cur, b->id, a->id, b->layer, a->layer);
+}
+
+/* grid cell of coordinate `x', rounding towards negative infinity */
+static int
+cell_of(int x, int cell)
+{
+	return x >= 0 ? x / cell : -((-(x + 1)) / cell) - 1;
+}
+
+static uint32_t
+cell_hash(int x, int y, size_t nbuckets)
+{
+	return ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u) & (nbuckets - 1);
+}
+
+/**
+ * Collect overlapping pairs of boxes in `cur', sorted and without duplicates
+ */
+static int
+detect(Collisions *c)
+{
+	size_t i, j, k, n, nbuckets;
+	int x, y, x0, y0, x1, y1;
+	uint32_t h;
+	void *p;
+	Body *a;
+	Pair *d;
+
+	c->cur.n = 0;
+	if (c->dirty && !bvh_build(c))
+		return 0;
+	for (i = 0; i < c->nbodies; ++i)
+		if (!bvh_query(c, &c->bodies[i]))
+			return 0;
+	/* every box goes to the buckets of all the cells it covers */
+	for (n = i = 0; i < c->nbodies; ++i) {
+		a = &c->bodies[i];
+		n += (size_t)(cell_of(a->x + a->w - 1, c->cell) - cell_of(a->x, c->cell) + 1)
+			* (cell_of(a->y + a->h - 1, c->cell) - cell_of(a->y, c->cell) + 1);
+	}
+	for (nbuckets = MIN_BUCKETS; nbuckets < n * 2; nbuckets *= 2)
+		;
+	k = c->entrycap;
+	if (!(p = reserve(c->hash, &k, n, sizeof(uint32_t))))
+		return 0;
+	c->hash = p;
+	k = c->entrycap;
+	if (!(p = reserve(c->body, &k, n, sizeof(uint32_t))))
+		return 0;
+	c->body = p;
+	if (!(p = reserve(c->sorted, &c->entrycap, n, sizeof(uint32_t))))
+		return 0;
+	c->sorted = p;
+	if (!(p = reserve(c->start, &c->bucketcap, nbuckets + 1, sizeof(size_t))))
+		return 0;
+	c->start = p;
+
+	/* counting sort of entries by bucket */
+	memset(c->start, 0, sizeof(size_t) * (nbuckets + 1));
+	for (k = i = 0; i < c->nbodies; ++i) {
+		a = &c->bodies[i];
+		x0 = cell_of(a->x, c->cell);
+		y0 = cell_of(a->y, c->cell);
+		x1 = cell_of(a->x + a->w - 1, c->cell);
+		y1 = cell_of(a->y + a->h - 1, c->cell);
+		for (y = y0; y <= y1; ++y) {
+			for (x = x0; x <= x1; ++x) {
+				h = cell_hash(x, y, nbuckets);
+				c->hash[k] = h;
+				c->body[k++] = i;
+				++c->start[h + 1];
+			}
+		}
+	}
+	for (i = 0; i < nbuckets; ++i)
+		c->start[i + 1] += c->start[i];
+	for (k = 0; k < n; ++k)
+		c->sorted[c->start[c->hash[k]]++] = c->body[k];
+	/* placing shifted every start over to the next bucket */
+	memmove(c->start + 1, c->start, sizeof(size_t) * nbuckets);
+	c->start[0] = 0;
+
+	for (h = 0; h < nbuckets; ++h) {
+		for (i = c->start[h]; i < c->start[h + 1]; ++i) {
+			a = &c->bodies[c->sorted[i]];
+			for (j = i + 1; j < c->start[h + 1]; ++j)
+				if (!collide(c, a, &c->bodies[c->sorted[j]]))
+					return 0;
+		}
+	}
+
+	if (!c->cur.n)
+		return 1;
+	/* boxes sharing several cells are found more than once */
+	qsort(c->cur.d, c->cur.n, sizeof(Pair), pair_cmp);
+	d = c->cur.d;
+	for (i = j = 0; i < c->cur.n; ++i)
+		if (!j || pair_cmp(&d[j - 1], &d[i]))
+			d[j++] = d[i];
+	c->cur.n = j;
+
+	return 1;
+}
+
+static int
+center_cmp_x(const void *p, const void *q)
+{
+	const Body *a, *b;
+
+	a = p;
+	b = q;
+	if (a->x + a->w / 2 != b->x + b->w / 2)
+		return a->x + a->w / 2 < b->x + b->w / 2 ? -1 : 1;
+	return 0;
+}
+
+static int
+center_cmp_y(const void *p, const void *q)
+{
+	const Body *a, *b;
+
+	a = p;
+	b = q;
+	if (a->y + a->h / 2 != b->y + b->h / 2)
+		return a->y + a->h / 2 < b->y + b->h / 2 ? -1 : 1;
+	return 0;
+}
+
+/**
+ * Make `node' cover `n' static boxes starting at `first', halving them
+ * along the longer axis until they fit in a leaf
+ * Returns the amount of levels of the subtree
+ */
+static size_t
+bvh_split(Collisions *c, size_t node, size_t first, size_t n)
+{
+	size_t i, child, l, r;
+	Node *nd;
+	Body *b;
+
+	nd = &c->nodes[node];
+	b = &c->statics[first];
+	nd->x0 = b->x;
+	nd->y0 = b->y;
+	nd->x1 = b->x + b->w;
+	nd->y1 = b->y + b->h;
+	for (i = 1; i < n; ++i) {
+		b = &c->statics[first + i];
+		nd->x0 = b->x < nd->x0 ? b->x : nd->x0;
+		nd->y0 = b->y < nd->y0 ? b->y : nd->y0;
+		nd->x1 = b->x + b->w > nd->x1 ? b->x + b->w : nd->x1;
+		nd->y1 = b->y + b->h > nd->y1 ? b->y + b->h : nd->y1;
+	}
+	if (n <= BVH_LEAF) {
+		nd->first = first;
+		nd->n = n;
+		return 1;
+	}
+	qsort(&c->statics[first], n, sizeof(Body),
+		nd->x1 - nd->x0 >= nd->y1 - nd->y0 ? center_cmp_x : center_cmp_y);
+	child = c->nnodes;
+	c->nnodes += 2;
+	nd->first = child;
+	nd->n = 0;
+	l = bvh_split(c, child, first, n / 2);
+	r = bvh_split(c, child + 1, first + n / 2, n - n / 2);
+
+	return 1 + (l > r ? l : r);
+}
+
+static int
+bvh_build(Collisions *c)
+{
+	void *p;
+	size_t depth;
+
+	c->nnodes = 0;
+	if (c->nstatics) {
+		/* a binary tree with `n' leaves has less than `2n' nodes */
+		if (!(p = reserve(c->nodes, &c->nodecap, c->nstatics * 2, sizeof(Node))))
+			return 0;
+		c->nodes = p;
+		c->nnodes = 1;
+		/* a query keeps at most one node per level pending, plus the
+		 * children of the deepest one */
+		if ((depth = bvh_split(c, 0, 0, c->nstatics)) + 1 > BVH_STACK) {
+			LOG_ERROR("static collision tree of %zu levels is too deep to query", depth);
+			c->nnodes = 0;
+			return 0;
+		}
+	}
+	c->dirty = 0;
+	LOG_DEBUG("built static collision tree of %zu boxes (%zu nodes)", c->nstatics, c->nnodes);
+
+	return 1;
+}
+
+/**
+ * Collect static boxes overlapping box `a'
+ */
+static int
+bvh_query(Collisions *c, const Body *a)
+{
+	size_t stack[BVH_STACK], top, i;
+	Node *nd;
+
+	if (!c->nnodes)
+		return 1;
+	stack[0] = 0;
+	top = 1;
+	while (top) {
+		nd = &c->nodes[stack[--top]];
+		if (a->x >= nd->x1 || a->x + a->w <= nd->x0
+			|| a->y >= nd->y1 || a->y + a->h <= nd->y0)
+			continue;
+		if (!nd->n) {
+			stack[top++] = nd->first;
+			stack[top++] = nd->first + 1;
+			continue;
+		}
+		for (i = nd->first; i < nd->first + nd->n; ++i)
+			if (!collide(c, a, &c->statics[i]))
+				return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Split pairs into events by merging the current and previous overlaps
+ */
+static void
+diff(Collisions *c)
+{
+	size_t i, j;
+	int cmp, ok;
+	Pair *p;
+
+	for (i = 0; i < NEVENTS; ++i)
+		c->events[i].n = 0;
+	ok = 1;
+	i = j = 0;
+	while (i < c->cur.n || j < c->prev.n) {
+		if (i == c->cur.n)
+			cmp = 1;
+		else if (j == c->prev.n)
+			cmp = -1;
+		else
+			cmp = pair_cmp(&c->cur.d[i], &c->prev.d[j]);
+		if (cmp < 0) {
+			p = &c->cur.d[i++];
+			ok &= pairs_push(&c->events[0], p->a, p->b, p->la, p->lb);
+		} else if (cmp > 0) {
+			p = &c->prev.d[j++];
+			ok &= pairs_push(&c->events[2], p->a, p->b, p->la, p->lb);
+		} else {
+			p = &c->cur.d[i++];
+			++j;
+			ok &= pairs_push(&c->events[1], p->a, p->b, p->la, p->lb);
+		}
+	}
+	if (!ok)
+		LOG_ERROR("failed recording some of collision events");
+}
+
+static void
+dispatch(Collisions *c)
+{
+	size_t h, i, n, nhandlers;
+	int e;
+	void *q;
+	Pair *p;
+
+	/* handlers added by other handlers wait for the next update */
+	nhandlers = c->nhandlers;
+	for (h = 0; h < nhandlers; ++h) {
+		for (e = 0; e < NEVENTS; ++e) {
+			if (!(c->handlers[h].events & 1 << e) || !c->events[e].n)
+				continue;
+			if (!(q = reserve(c->batch, &c->batchcap, c->events[e].n, sizeof(CollisionPair)))) {
+				LOG_ERROR("failed batching collision events");
+				return;
+			}
+			c->batch = q;
+			for (n = i = 0; i < c->events[e].n; ++i) {
+				p = &c->events[e].d[i];
+				if (p->la & c->handlers[h].layer && p->lb & c->handlers[h].other) {
+					c->batch[n].first = p->a;
+					c->batch[n++].second = p->b;
+				} else if (p->lb & c->handlers[h].layer && p->la & c->handlers[h].other) {
+					c->batch[n].first = p->b;
+					c->batch[n++].second = p->a;
+				}
+			}
+			if (n)
+				c->handlers[h].fn(1 << e, c->batch, n, c->handlers[h].ctx);
+		}
+	}
+}
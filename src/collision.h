@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ *
+ * Detect collisions of axis-aligned boxes
+ */
+
+enum collision_event {
+	COLLISION_ENTER = 1 << 0, /* boxes started overlapping */
+	COLLISION_STAY  = 1 << 1, /* boxes kept overlapping since the last update */
+	COLLISION_EXIT  = 1 << 2  /* boxes stopped overlapping or one of them is gone */
+};
+
+typedef struct {
+	int first, second;
+} CollisionPair;
+
+typedef struct collisions Collisions;
+
+Collisions * collisions_create(int);
+void collisions_destroy(Collisions *);
+int collisions_handle(Collisions *, uint32_t, uint32_t, int, void (*)(enum collision_event, const CollisionPair *, size_t, void *), void *);
+int collisions_add(Collisions *, int, int, int, int, int, uint32_t, uint32_t);
+int collisions_add_static(Collisions *, int, int, int, int, int, uint32_t, uint32_t);
+void collisions_clear_static(Collisions *);
+void collisions_update(Collisions *);
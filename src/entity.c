@@ -35,15 +35,45 @@
 #include "log.h"
 #include "ff.h"
 #include "render.h"
+#include "cmdlist.h"
 #include "audio.h"
 #include "entity.h"
+#include "worker.h"
+#include "kin.h"
+#include "collision.h"
+#include "tilemap.h"
 //#include "sched.h"
 
 #define ABS(x) ((x < 0) ? -x : x)
-#define MAX_ENTITIES 1024
+#define NCOMPONENTS 11
+#define NCOLUMNS (NCOMPONENTS + 1)
+#define CHUNK_SIZE 256 /* amount of entities stored in a single archetype chunk */
+#define CACHE_LINE 64
+#define ALIGN(x) (((x) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+#define ENTITIES_INIT_CAP 1024
+#define POOL_INIT_CAP 64
+/* rows per batch of data-parallel systems; a multiple of 16 rows keeps
+ * columns of every batch starting at a cache line boundary */
+#define PARALLEL_BATCH 64
+#define PARALLEL_THRESHOLD 2048 /* systems with fewer entities stay single threaded */
 
-#define ANIM_TICKS_PER_FRAME 150
-#define ANIM_TEXT_TICKS_PER_FRAME ANIM_TICKS_PER_FRAME/2
+/* components stored in sparse-set pools instead of archetype chunks; adding
+ * or removing them does not move an entity between archetypes */
+#define SPARSE_COMPONENTS (COMPONENT_ANIM)
+
+/* entity handles are an index into entity table plus a generation counter of
+ * the slot; sign bit is left clear so that negative ids signal errors */
+#define ENTITY_INDEX_BITS 20
+#define MAX_ENTITY_INDEX (1 << ENTITY_INDEX_BITS)
+#define ENTITY_GEN_MASK 0x7ff
+#define INDEX(id) ((size_t)(id) & (MAX_ENTITY_INDEX - 1))
+#define GEN(id) ((uint32_t)(id) >> ENTITY_INDEX_BITS)
+#define HANDLE(i, gen) ((int)((uint32_t)(gen) << ENTITY_INDEX_BITS | (uint32_t)(i)))
+
+#define ANIM_FRAME_TIME .15 /* seconds a frame of walking is shown */
+#define ANIM_TEXT_FRAME_TIME (ANIM_FRAME_TIME / 2) /* seconds between text reveals */
+#define ANIM_TICKS_PER_FRAME (unsigned long)(ANIM_FRAME_TIME * TICK_RATE + .5)
+#define ANIM_TEXT_TICKS_PER_FRAME (unsigned long)(ANIM_TEXT_FRAME_TIME * TICK_RATE + .5)
 #define ANIM_TEXT_CHARS_PER_FRAME 3
 #define ANIM_TEXT_SOUND "blip"
 #define ANIM_MAX_FRAMES 4
@@ -62,6 +92,25 @@ enum anim_direction {
 	ANIM_DIR_RIGHT
 };
 
+/* column index of each component inside archetype chunks */
+enum column {
+	COLUMN_DIM = 0,
+	COLUMN_POS,
+	COLUMN_VEL,
+	COLUMN_ACC,
+	COLUMN_ZPOS,
+	COLUMN_SPRITE,
+	COLUMN_ANIM,
+	COLUMN_TEXT,
+	COLUMN_INPUT,
+	COLUMN_COLLIDER,
+	COLUMN_STATIC,
+	COLUMN_PREV /* not a component; kept along with COLUMN_POS */
+};
+
+/* columns stored by chunks of an archetype of signature `m' */
+#define COLUMNS(m) ((m) & COMPONENT_POS ? (m) | 1 << COLUMN_PREV : (m))
+
 typedef struct vec2 {
 	int x, y;
 } Vec2;
@@ -77,73 +126,267 @@ typedef struct sprite {
 	int offs_x, offs_y;
 } Sprite;
 
-typedef struct entities {
-	int exists[MAX_ENTITIES];
-	uint32_t components[MAX_ENTITIES];
-	size_t n;
-} Entities;
+typedef struct collider {
+	uint32_t layer, mask;
+} Collider;
 
+/**
+ * A packed view over a slice of entities sharing the same signature
+ * Component arrays are indexed by the position in the slice (not by entity
+ * id); arrays of components absent from the signature are NULL
+ */
 typedef struct components {
-	Vec2 dim[MAX_ENTITIES], pos[MAX_ENTITIES], vel[MAX_ENTITIES], acc[MAX_ENTITIES];
-	int zpos[MAX_ENTITIES];
-	Sprite sprite[MAX_ENTITIES];
-	Text text[MAX_ENTITIES];
-	size_t anim[MAX_ENTITIES][ANIM_NFIELDS];
+	size_t n;
+	int *ids;
+	Vec2 *dim, *pos, *vel, *acc;
+	Vec2 *prev; /* `pos' at the start of the last tick */
+	int *zpos;
+	Sprite *sprite;
+	size_t (*anim)[ANIM_NFIELDS];
+	Text *text;
+	Collider *collider;
 } Components;
 
+/**
+ * Fixed-size block of SoA component storage; every column holds
+ * `CHUNK_SIZE' elements and starts at a cache line boundary
+ */
+typedef struct chunk {
+	Components c;
+	void *col[NCOLUMNS];
+	void *mem;
+} Chunk;
+
+/**
+ * Storage for all entities of the same component signature
+ * Entities are kept packed: row `i' lives in chunk `i / CHUNK_SIZE'
+ */
+typedef struct archetype {
+	uint32_t mask;
+	Chunk **chunks;
+	size_t nchunks, n;
+	size_t index; /* order of creation */
+} Archetype;
+
+/**
+ * Cached list of archetypes matching a system signature
+ * Updated whenever a new archetype gets created, so that systems never
+ * filter entities themselves
+ */
+typedef struct query {
+	uint32_t mask, exclude;
+	Archetype **arch;
+	size_t n, cap;
+} Query;
+
+/**
+ * Sparse set of component values
+ * Values are kept packed in `dense' along with the handles of their owners;
+ * `sparse' maps an entity slot to the position in the packed arrays
+ * Before systems run, values are put in the order their owners are stored
+ * in archetype chunks, so that joins walk both linearly
+ */
+typedef struct pool {
+	size_t size;
+	char *dense;
+	int *ids;
+	size_t *sparse;
+	size_t n, cap, nsparse;
+} Pool;
+
+/* position of a pool value and where its owner is stored */
+typedef struct pool_order {
+	uint64_t key;
+	size_t i;
+} PoolOrder;
+
+typedef struct entities {
+	Archetype **arch; /* NULL for unused slots */
+	uint32_t *mask; /* full signature incl. sparse components */
+	size_t *row; /* row in the archetype; next free slot for unused slots */
+	uint16_t *gen;
+	size_t n, cap;
+	size_t free_head, free_tail, nfree; /* FIFO of unused slots */
+} Entities;
+
+typedef struct system_ctx {
+	GameState *state;
+	void (*fn)(GameState *, Components *);
+	unsigned long calls, rows;
+} SystemCtx;
+
+typedef struct system_job {
+	GameState *state;
+	int sys;
+	unsigned long calls, rows;
+} SystemJob;
+
+enum system_flag {
+	/* system has side effects beyond its components (polls input, plays
+	 * audio, changes entity signatures); it is always run by the thread
+	 * calling `process_tick' */
+	SYSTEM_MAIN_THREAD = 1 << 0,
+	/* system only touches the rows it is given, so its entities can be split
+	 * into batches processed concurrently */
+	SYSTEM_PARALLEL_FOR = 1 << 1
+};
+
+/* structural changes requested while systems are running */
+enum pending_op {
+	PENDING_SET = 0,
+	PENDING_DELETE,
+	PENDING_SPAWN
+};
+
+/* a batch of a data-parallel system */
+typedef struct batch_job {
+	GameState *state;
+	int sys;
+	Components c; /* rows of a chunk */
+	size_t start, end; /* range of the smallest pool for systems with sparse components */
+	unsigned long calls, rows;
+} BatchJob;
+
+#define NSYSTEMS 5
+#define NRENDERSYSTEMS 2
+
 struct entity_manager {
 	Entities entities;
-	Components components;
+	Archetype **archetypes;
+	size_t narchetypes;
+	Query queries[NSYSTEMS], render_queries[NRENDERSYSTEMS];
+	Query statics; /* static colliders */
+	int statics_dirty; /* statics changed since last passed to collisions */
+	Pool pools[NCOMPONENTS];
+	int pools_dirty; /* pools may be out of storage order */
+	struct {
+		BatchJob *d;
+		size_t cap;
+	} batches[NSYSTEMS];
+	/* structural changes requested while systems are running */
+	struct {
+		int id, op;
+		uint32_t mask;
+		EntityInfo info; /* of an entity spawned meanwhile */
+	} *pending;
+	size_t npending, pendingcap;
+	size_t nreserved; /* slots past the entity table handed out meanwhile */
+	int lock;
+	EntityStats stats;
+};
+
+static const size_t column_size[NCOLUMNS] = {
+	sizeof(Vec2), /* COLUMN_DIM */
+	sizeof(Vec2), /* COLUMN_POS */
+	sizeof(Vec2), /* COLUMN_VEL */
+	sizeof(Vec2), /* COLUMN_ACC */
+	sizeof(int), /* COLUMN_ZPOS */
+	sizeof(Sprite), /* COLUMN_SPRITE */
+	sizeof(size_t) * ANIM_NFIELDS, /* COLUMN_ANIM */
+	sizeof(Text), /* COLUMN_TEXT */
+	0, /* COLUMN_INPUT; a tag without data */
+	sizeof(Collider), /* COLUMN_COLLIDER */
+	0, /* COLUMN_STATIC; a tag without data */
+	sizeof(Vec2) /* COLUMN_PREV */
 };
 
-static size_t entity_get_subset(const EntityManager *, int *, size_t, uint32_t);
+static int entities_grow(Entities *);
+static Chunk * chunk_create(uint32_t);
+static void chunk_destroy(Chunk *);
+static void query_add(Query *, Archetype *);
+static void * pool_insert(Pool *, int);
+static void pool_remove(Pool *, int);
+static void * pool_get(const Pool *, int);
+static Pool * pool_smallest(EntityManager *, uint32_t);
+static int pool_order_cmp(const void *, const void *);
+static void pool_sort(EntityManager *, Pool *);
+static int pool_adjacent(const EntityManager *, uint32_t, int, int, size_t);
+static void pool_join(EntityManager *, uint32_t, size_t, size_t, void (*)(EntityManager *, Components *, void *), void *);
+static Archetype * archetype_get(EntityManager *, uint32_t);
+static size_t archetype_push(EntityManager *, Archetype *, int);
+static void archetype_remove(EntityManager *, Archetype *, size_t);
+static void * entity_slot(const EntityManager *, int, int);
+static void components_slice(const Components *, size_t, size_t, Components *);
+static void entity_run_system(EntityManager *, Components *, void *);
+static int system_active(const EntityManager *, int);
+static int system_moves(const Archetype *);
+static int system_conflict(int, int);
+static size_t system_split(EntityManager *, GameState *, int);
+static void system_run(void *);
+static void batch_run(void *);
+static void entity_place(EntityManager *, int, const EntityInfo *);
+static int entity_defer(EntityManager *, int, int, uint32_t, const EntityInfo *);
+static void entity_flush(EntityManager *);
+static void entity_sync_statics(EntityManager *, Collisions *);
 /* Entity `Systems' functions declarations */
-static void entity_render(EntityManager *, Gc *, int *, size_t);
-static void entity_render_texts(EntityManager *, Gc *, int *, size_t);
-static void entity_accelerate(GameState *, int *, size_t);
-static void entity_displace(GameState *, int *, size_t);
-static void entity_animate_vel(GameState *, int *, size_t);
-static void entity_animate_text(GameState *, int *, size_t);
-
-#define NSYSTEMS 4
-#define NRENDERSYSTEMS 2
+static void entity_render_sprites(EntityManager *, CmdList *, Components *, float);
+static void entity_render_texts(EntityManager *, CmdList *, Components *, float);
+static Vec2 entity_lerp(const Components *, size_t, float);
+static void entity_accelerate(GameState *, Components *);
+static void entity_displace(GameState *, Components *);
+static void entity_animate_vel(GameState *, Components *);
+static void entity_animate_text(GameState *, Components *);
+static void entity_collide(GameState *, Components *);
 
 /* Entity `Systems' vtable */
 static const struct {
-	uint32_t mask; /* system signature; a mask for filtering entity list before
-	                  passing it over to the `system' function */
-	void (*fn)(GameState *, int *, size_t); /* `system' function ptr */
+	uint32_t mask; /* system signature; only chunks of archetypes matching
+	                  the mask are passed over to the `system' function */
+	uint32_t exclude; /* archetypes having any of these are skipped */
+	uint32_t read, write; /* components accessed by the system; systems with
+	                         conflicting access are never run concurrently */
+	int flags;
+	void (*fn)(GameState *, Components *); /* `system' function ptr */
 } systems_vtable[NSYSTEMS] = {
 	{
 		/* move controllable objects (e.g. player) */
-		.mask = (COMPONENT_ACC | COMPONENT_INPUT),
+		.mask = (COMPONENT_ACC | COMPONENT_VEL | COMPONENT_INPUT),
+		.read = (COMPONENT_VEL | COMPONENT_INPUT),
+		.write = COMPONENT_ACC,
+		.flags = SYSTEM_MAIN_THREAD,
 		.fn = entity_accelerate
 	},
 	{
 		/* move rigid bodies */
 		.mask = (COMPONENT_ACC | COMPONENT_VEL | COMPONENT_POS | COMPONENT_DIM),
+		.read = COMPONENT_ACC,
+		.write = (COMPONENT_VEL | COMPONENT_POS),
+		.flags = SYSTEM_PARALLEL_FOR,
 		.fn = entity_displace
 	},
 	{
 		/* animate moving objects */
 		.mask = (COMPONENT_VEL | COMPONENT_SPRITE | COMPONENT_ANIM),
+		.read = COMPONENT_VEL,
+		.write = (COMPONENT_SPRITE | COMPONENT_ANIM),
+		.flags = SYSTEM_PARALLEL_FOR,
 		.fn = entity_animate_vel
 	},
 	{
 		/* animate text */
 		.mask = (COMPONENT_TEXT | COMPONENT_ANIM),
+		.write = (COMPONENT_TEXT | COMPONENT_ANIM),
+		.flags = SYSTEM_MAIN_THREAD,
 		.fn = entity_animate_text
+	},
+	{
+		/* feed collision detection with boxes of moving entities */
+		.mask = (COMPONENT_POS | COMPONENT_DIM | COMPONENT_COLLIDER),
+		.exclude = COMPONENT_STATIC,
+		.read = (COMPONENT_POS | COMPONENT_DIM | COMPONENT_COLLIDER),
+		.flags = SYSTEM_MAIN_THREAD,
+		.fn = entity_collide
 	}
 };
 
 static const struct {
 	uint32_t mask;
-	void (*fn)(EntityManager *, Gc *, int *, size_t);
+	void (*fn)(EntityManager *, CmdList *, Components *, float);
 } render_systems_vtable[NRENDERSYSTEMS] = {
 	{
-		/* render sprites */
+		/* queue sprites to be drawn ordered by zpos and depth */
 		.mask = (COMPONENT_SPRITE | COMPONENT_DIM | COMPONENT_POS | COMPONENT_ZPOS),
-		.fn = entity_render
+		.fn = entity_render_sprites
 	},
 	{
 		/* print texts */
@@ -158,12 +401,25 @@ create_entity_manager(void)
 {
 	EntityManager *emgr;
 	size_t z;
+	int i;
 
 	z = sizeof(EntityManager);
 	emgr = calloc(z, 1);
 	if (!emgr)
 		LOG_FATAL("failed allocating a new entity manager");
 	LOG_TRACE("allocated %zuB for an entity manager", z);
+	/* sparse components are resolved by joining pools, not by queries */
+	for (i = 0; i < NSYSTEMS; ++i) {
+		emgr->queries[i].mask = systems_vtable[i].mask & ~SPARSE_COMPONENTS;
+		emgr->queries[i].exclude = systems_vtable[i].exclude;
+	}
+	for (i = 0; i < NRENDERSYSTEMS; ++i)
+		emgr->render_queries[i].mask = render_systems_vtable[i].mask & ~SPARSE_COMPONENTS;
+	emgr->statics.mask = (COMPONENT_POS | COMPONENT_DIM | COMPONENT_COLLIDER | COMPONENT_STATIC);
+	emgr->statics_dirty = 1;
+	for (i = 0; i < NCOMPONENTS; ++i)
+		emgr->pools[i].size = column_size[i];
+	kin_init(1. / TICK_RATE);
 
 	return emgr;
 }
@@ -171,38 +427,75 @@ create_entity_manager(void)
 void
 destroy_entity_manager(EntityManager *emgr)
 {
+	size_t i, j;
+
+	for (i = 0; i < emgr->narchetypes; ++i) {
+		for (j = 0; j < emgr->archetypes[i]->nchunks; ++j)
+			chunk_destroy(emgr->archetypes[i]->chunks[j]);
+		free(emgr->archetypes[i]->chunks);
+		free(emgr->archetypes[i]);
+	}
+	free(emgr->archetypes);
+	for (i = 0; i < NSYSTEMS; ++i)
+		free(emgr->queries[i].arch);
+	for (i = 0; i < NRENDERSYSTEMS; ++i)
+		free(emgr->render_queries[i].arch);
+	free(emgr->statics.arch);
+	for (i = 0; i < NSYSTEMS; ++i)
+		free(emgr->batches[i].d);
+	for (i = 0; i < NCOMPONENTS; ++i) {
+		free(emgr->pools[i].dense);
+		free(emgr->pools[i].ids);
+		free(emgr->pools[i].sparse);
+	}
+	free(emgr->entities.arch);
+	free(emgr->entities.mask);
+	free(emgr->entities.row);
+	free(emgr->entities.gen);
+	free(emgr->pending);
 	free(emgr);
 }
 
+/**
+ * Spawn an entity described by `e'
+ * Entities spawned while systems are running (e.g. by collision handlers)
+ * get their handle right away but only come to life once the systems are
+ * done with the tick
+ */
 int
 entity_spawn(EntityManager *emgr, EntityInfo e)
 {
-	int i = -1;
+	int i;
+	size_t slot;
 
-	while (emgr->entities.exists[++i])
-		if (i+1 >= MAX_ENTITIES) {
+	if (emgr->entities.nfree) {
+		/* reuse the slot that has been freed the longest time ago */
+		slot = emgr->entities.free_head;
+		emgr->entities.free_head = emgr->entities.row[slot];
+		--emgr->entities.nfree;
+		i = HANDLE(slot, emgr->entities.gen[slot]);
+	} else if (emgr->lock) {
+		/* the table is not grown under the running systems; the slot past
+		 * its end is taken once they are done */
+		slot = emgr->entities.n + emgr->nreserved;
+		if (slot == MAX_ENTITY_INDEX) {
+			LOG_ERROR("reached limit of entities");
+			return -1;
+		}
+		++emgr->nreserved;
+		i = HANDLE(slot, 0);
+	} else {
+		if (emgr->entities.n == emgr->entities.cap && entities_grow(&emgr->entities) < 0) {
 			LOG_ERROR("reached limit of entities");
 			return -1;
 		}
-	if (emgr->entities.n == i)
-		++emgr->entities.n;
-	emgr->entities.exists[i] = 1;
-	emgr->entities.components[i] = e.components;
-	/* TODO set component data only if the enum is set */
-	emgr->components.vel[i].x = 0;
-	emgr->components.vel[i].y = 0;
-	emgr->components.acc[i] = emgr->components.vel[i];
-	emgr->components.sprite[i].id = e.sprite;
-	emgr->components.sprite[i].offs_x = 0;
-	emgr->components.sprite[i].offs_y = 0;
-	emgr->components.pos[i].x = e.x;
-	emgr->components.pos[i].y = e.y;
-	emgr->components.dim[i].x = e.w;
-	emgr->components.dim[i].y = e.h;
-	emgr->components.zpos[i] = e.z;
-	emgr->components.anim[i][ANIM_FRAME] =
-	emgr->components.anim[i][ANIM_DIR] =
-	emgr->components.anim[i][ANIM_TICKS] = 0;
+		slot = emgr->entities.n++;
+		emgr->entities.gen[slot] = 0;
+		i = HANDLE(slot, 0);
+	}
+	if (emgr->lock)
+		return entity_defer(emgr, i, PENDING_SPAWN, 0, &e) ? i : -1;
+	entity_place(emgr, i, &e);
 
 	return i;
 }
@@ -210,42 +503,116 @@ entity_spawn(EntityManager *emgr, EntityInfo e)
 int
 entity_spawn_text(EntityManager *emgr, int font, int x, int y, const char *str, int animate)
 {
-	int id;
 	EntityInfo info;
 
+	memset(&info, 0, sizeof(EntityInfo));
 	info.components = (COMPONENT_POS | COMPONENT_TEXT);
+	if (animate)
+		info.components |= COMPONENT_ANIM;
 	info.x = x;
 	info.y = y;
-	id = entity_spawn(emgr, info);
-	if (id < 0)
-		return id;
-
-	if (animate) {
-		emgr->entities.components[id] |= COMPONENT_ANIM;
-		emgr->components.text[id].len = 1;
-		emgr->components.anim[id][0] = 0;
-	} else {
-		emgr->components.text[id].len = strlen(str);
-	}
-	emgr->components.text[id].str = str;
-	emgr->components.text[id].font = font;
+	info.sprite = font;
+	info.txt = str;
 
-	return id;
+	return entity_spawn(emgr, info);
 }
 
 int
 entity_get_info(EntityManager *emgr, int id, EntityInfo *e)
 {
-	if (id >= MAX_ENTITIES || !emgr->entities.exists[id]) {
+	Vec2 *v;
+	Sprite *s;
+	Text *txt;
+	Collider *col;
+	int *z;
+
+	if (!entity_valid(emgr, id)) {
 		LOG_ERROR("cannot get info for non-existent entity #%d", id);
 		return 0;
 	}
-	e->sprite = emgr->components.sprite[id].id;
-	e->x = emgr->components.pos[id].x;
-	e->y = emgr->components.pos[id].y;
-	e->z = emgr->components.zpos[id];
-	e->w = emgr->components.dim[id].x;
-	e->h = emgr->components.dim[id].x;
+	memset(e, 0, sizeof(EntityInfo));
+	e->components = emgr->entities.mask[INDEX(id)];
+	if ((s = entity_slot(emgr, id, COLUMN_SPRITE)))
+		e->sprite = s->id;
+	if ((v = entity_slot(emgr, id, COLUMN_POS))) {
+		e->x = v->x;
+		e->y = v->y;
+	}
+	if ((v = entity_slot(emgr, id, COLUMN_VEL))) {
+		e->vx = v->x;
+		e->vy = v->y;
+	}
+	if ((z = entity_slot(emgr, id, COLUMN_ZPOS)))
+		e->z = *z;
+	if ((v = entity_slot(emgr, id, COLUMN_DIM))) {
+		e->w = v->x;
+		e->h = v->y;
+	}
+	if ((txt = entity_slot(emgr, id, COLUMN_TEXT))) {
+		e->txt = txt->str;
+		e->sprite = txt->font;
+	}
+	if ((col = entity_slot(emgr, id, COLUMN_COLLIDER))) {
+		e->layer = col->layer;
+		e->mask = col->mask;
+	}
+
+	return 1;
+}
+
+/**
+ * Change signature of an entity, moving it over to a matching archetype
+ * Data of the components present in both signatures is preserved, newly
+ * added components are zeroed
+ */
+int
+entity_set_components(EntityManager *emgr, int id, enum component mask)
+{
+	int c;
+	size_t row, nrow;
+	uint32_t old;
+	Archetype *a, *b;
+	void *dst, *src;
+
+	if (!entity_valid(emgr, id)) {
+		LOG_WARNING("cannot set components of non-existent entity #%d", id);
+		return 0;
+	}
+	if (emgr->lock)
+		return entity_defer(emgr, id, PENDING_SET, mask, NULL);
+	old = emgr->entities.mask[INDEX(id)];
+	emgr->entities.mask[INDEX(id)] = mask;
+	if ((old | mask) & COMPONENT_STATIC)
+		emgr->statics_dirty = 1;
+	/* sparse components are simply added to or removed from their pools */
+	for (c = 0; c < NCOMPONENTS; ++c) {
+		if (!((old ^ mask) & SPARSE_COMPONENTS & 1 << c))
+			continue;
+		if (mask & 1 << c)
+			pool_insert(&emgr->pools[c], id);
+		else
+			pool_remove(&emgr->pools[c], id);
+		emgr->pools_dirty = 1;
+	}
+	a = emgr->entities.arch[INDEX(id)];
+	if (a->mask == (mask & ~SPARSE_COMPONENTS))
+		return 1;
+	row = emgr->entities.row[INDEX(id)];
+	b = archetype_get(emgr, mask & ~SPARSE_COMPONENTS);
+	nrow = archetype_push(emgr, b, id);
+	for (c = 0; c < NCOLUMNS; ++c) {
+		if (!column_size[c] || !(COLUMNS(a->mask) & COLUMNS(b->mask) & 1 << c))
+			continue;
+		dst = (char *)b->chunks[nrow / CHUNK_SIZE]->col[c] + column_size[c] * (nrow % CHUNK_SIZE);
+		src = (char *)a->chunks[row / CHUNK_SIZE]->col[c] + column_size[c] * (row % CHUNK_SIZE);
+		memcpy(dst, src, column_size[c]);
+	}
+	/* a position just given has not moved during the last tick, nor does
+	 * one no system is going to move any more */
+	if (b->mask & COMPONENT_POS && (!(a->mask & COMPONENT_POS) || !system_moves(b)))
+		*(Vec2 *)entity_slot(emgr, id, COLUMN_PREV) = *(Vec2 *)entity_slot(emgr, id, COLUMN_POS);
+	archetype_remove(emgr, a, row);
+	LOG_TRACE("moved entity #%d from archetype %#x to %#x", id, a->mask, b->mask);
 
 	return 1;
 }
@@ -253,249 +620,1087 @@ entity_get_info(EntityManager *emgr, int id, EntityInfo *e)
 void
 entity_delete(EntityManager *emgr, int id)
 {
-	if (id >= MAX_ENTITIES || !emgr->entities.exists[id]) {
+	int c;
+	size_t slot;
+	Entities *ents;
+
+	if (!entity_valid(emgr, id)) {
 		LOG_WARNING("cannot delete non-existent entity #%d", id);
 		return;
 	}
-	emgr->entities.exists[id] = 0;
-	if (emgr->entities.n == id + 1)
-		--emgr->entities.n;
+	if (emgr->lock) {
+		entity_defer(emgr, id, PENDING_DELETE, 0, NULL);
+		return;
+	}
+	ents = &emgr->entities;
+	slot = INDEX(id);
+	archetype_remove(emgr, ents->arch[slot], ents->row[slot]);
+	if (ents->mask[slot] & COMPONENT_STATIC)
+		emgr->statics_dirty = 1;
+	for (c = 0; c < NCOMPONENTS; ++c)
+		if (ents->mask[slot] & SPARSE_COMPONENTS & 1 << c)
+			pool_remove(&emgr->pools[c], id);
+	ents->arch[slot] = NULL;
+	/* invalidate all outstanding handles to the slot */
+	ents->gen[slot] = (ents->gen[slot] + 1) & ENTITY_GEN_MASK;
+	if (ents->nfree)
+		ents->row[ents->free_tail] = slot;
+	else
+		ents->free_head = slot;
+	ents->free_tail = slot;
+	++ents->nfree;
 	LOG_TRACE("removed entity #%d", id);
 }
 
 /**
- * Get a subset of entites that fit signature
- * Entity id's are stored into the provided buffer and the amount of found
- * entities is returned
+ * Check whether a handle refers to a live entity
+ * Handles of deleted entities stay invalid even after their slot is reused
+ */
+int
+entity_valid(const EntityManager *emgr, int id)
+{
+	size_t slot;
+
+	if (id < 0)
+		return 0;
+	slot = INDEX(id);
+	return slot < emgr->entities.n && emgr->entities.arch[slot]
+		&& emgr->entities.gen[slot] == GEN(id);
+}
+
+static int
+entities_grow(Entities *ents)
+{
+	size_t cap;
+	void *arch, *mask, *row, *gen;
+
+	cap = ents->cap ? ents->cap * 2 : ENTITIES_INIT_CAP;
+	if (cap > MAX_ENTITY_INDEX)
+		cap = MAX_ENTITY_INDEX;
+	if (cap == ents->cap)
+		return -1;
+	arch = realloc(ents->arch, sizeof(Archetype *) * cap);
+	if (arch)
+		ents->arch = arch;
+	mask = realloc(ents->mask, sizeof(uint32_t) * cap);
+	if (mask)
+		ents->mask = mask;
+	row = realloc(ents->row, sizeof(size_t) * cap);
+	if (row)
+		ents->row = row;
+	gen = realloc(ents->gen, sizeof(uint16_t) * cap);
+	if (gen)
+		ents->gen = gen;
+	if (!arch || !mask || !row || !gen)
+		LOG_FATAL("failed growing entity table to %zu entries", cap);
+	memset(&ents->arch[ents->cap], 0, sizeof(Archetype *) * (cap - ents->cap));
+	ents->cap = cap;
+
+	return 0;
+}
+
+/**
+ * Register a new archetype with a query if it fits the query signature
+ */
+static void
+query_add(Query *q, Archetype *a)
+{
+	size_t cap;
+	Archetype **arch;
+
+	if ((a->mask & q->mask) != q->mask || a->mask & q->exclude)
+		return;
+	if (q->n == q->cap) {
+		cap = q->cap ? q->cap * 2 : 8;
+		arch = realloc(q->arch, sizeof(Archetype *) * cap);
+		if (!arch)
+			LOG_FATAL("failed growing query %#x", q->mask);
+		q->arch = arch;
+		q->cap = cap;
+	}
+	q->arch[q->n++] = a;
+}
+
+/**
+ * Add a zeroed value for entity `id' to the pool
+ */
+static void *
+pool_insert(Pool *p, int id)
+{
+	size_t slot, cap, i;
+	void *dense, *ids, *sparse;
+
+	slot = INDEX(id);
+	if (slot >= p->nsparse) {
+		cap = p->nsparse ? p->nsparse : POOL_INIT_CAP;
+		while (cap <= slot)
+			cap *= 2;
+		sparse = realloc(p->sparse, sizeof(size_t) * cap);
+		if (!sparse)
+			LOG_FATAL("failed growing sparse index to %zu entries", cap);
+		p->sparse = sparse;
+		for (i = p->nsparse; i < cap; ++i)
+			p->sparse[i] = SIZE_MAX;
+		p->nsparse = cap;
+	}
+	if (p->n == p->cap) {
+		cap = p->cap ? p->cap * 2 : POOL_INIT_CAP;
+		dense = realloc(p->dense, p->size * cap);
+		if (dense)
+			p->dense = dense;
+		ids = realloc(p->ids, sizeof(int) * cap);
+		if (ids)
+			p->ids = ids;
+		if (!dense || !ids)
+			LOG_FATAL("failed growing component pool to %zu entries", cap);
+		p->cap = cap;
+	}
+	p->sparse[slot] = p->n;
+	p->ids[p->n] = id;
+	memset(p->dense + p->size * p->n, 0, p->size);
+
+	return p->dense + p->size * p->n++;
+}
+
+/**
+ * Remove value of entity `id' by moving the last packed value in its place
+ */
+static void
+pool_remove(Pool *p, int id)
+{
+	size_t i, last;
+
+	if (!pool_get(p, id))
+		return;
+	i = p->sparse[INDEX(id)];
+	last = --p->n;
+	if (i != last) {
+		memcpy(p->dense + p->size * i, p->dense + p->size * last, p->size);
+		p->ids[i] = p->ids[last];
+		p->sparse[INDEX(p->ids[i])] = i;
+	}
+	p->sparse[INDEX(id)] = SIZE_MAX;
+}
+
+static void *
+pool_get(const Pool *p, int id)
+{
+	size_t slot;
+
+	slot = INDEX(id);
+	if (slot >= p->nsparse || p->sparse[slot] >= p->n || p->ids[p->sparse[slot]] != id)
+		return NULL;
+	return p->dense + p->size * p->sparse[slot];
+}
+
+static Pool *
+pool_smallest(EntityManager *emgr, uint32_t mask)
+{
+	int c;
+	Pool *p;
+
+	p = NULL;
+	for (c = 0; c < NCOMPONENTS; ++c)
+		if (mask & SPARSE_COMPONENTS & 1 << c && (!p || emgr->pools[c].n < p->n))
+			p = &emgr->pools[c];
+	return p;
+}
+
+static int
+pool_order_cmp(const void *a, const void *b)
+{
+	const PoolOrder *x, *y;
+
+	x = a;
+	y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+/**
+ * Put values of a pool in the order their owners are stored in
+ */
+static void
+pool_sort(EntityManager *emgr, Pool *p)
+{
+	int sorted;
+	size_t i, slot;
+	PoolOrder *order;
+	char *dense;
+	int *ids;
+
+	if (p->n < 2)
+		return;
+	order = malloc(sizeof(PoolOrder) * p->n);
+	dense = malloc(p->size * p->cap);
+	ids = malloc(sizeof(int) * p->cap);
+	if (!order || !dense || !ids) {
+		LOG_WARNING("failed sorting a component pool; joins stay scattered");
+		free(order);
+		free(dense);
+		free(ids);
+		return;
+	}
+	sorted = 1;
+	for (i = 0; i < p->n; ++i) {
+		slot = INDEX(p->ids[i]);
+		order[i].key = (uint64_t)emgr->entities.arch[slot]->index << 32 | emgr->entities.row[slot];
+		order[i].i = i;
+		if (i && order[i].key < order[i - 1].key)
+			sorted = 0;
+	}
+	if (sorted) {
+		free(order);
+		free(dense);
+		free(ids);
+		return;
+	}
+	qsort(order, p->n, sizeof(PoolOrder), pool_order_cmp);
+	for (i = 0; i < p->n; ++i) {
+		memcpy(dense + p->size * i, p->dense + p->size * order[i].i, p->size);
+		ids[i] = p->ids[order[i].i];
+		p->sparse[INDEX(ids[i])] = i;
+	}
+	free(p->dense);
+	free(p->ids);
+	free(order);
+	p->dense = dense;
+	p->ids = ids;
+}
+
+/**
+ * Check whether entity `next' is stored `n' rows after `id' in the same
+ * chunk and follows it in all pools of `mask' as well
+ */
+static int
+pool_adjacent(const EntityManager *emgr, uint32_t mask, int id, int next, size_t n)
+{
+	int c;
+	size_t row;
+	const Pool *p;
+
+	row = emgr->entities.row[INDEX(id)] + n;
+	if ((emgr->entities.mask[INDEX(next)] & mask) != mask
+		|| emgr->entities.arch[INDEX(next)] != emgr->entities.arch[INDEX(id)]
+		|| emgr->entities.row[INDEX(next)] != row || row % CHUNK_SIZE == 0)
+		return 0;
+	for (c = 0; c < NCOMPONENTS; ++c) {
+		if (!(mask & SPARSE_COMPONENTS & 1 << c))
+			continue;
+		p = &emgr->pools[c];
+		if (p->sparse[INDEX(next)] != p->sparse[INDEX(id)] + n)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Call `fn' for runs of entities having all the components of `mask'
+ * Only the smallest pool among sparse components of the mask is walked
+ * (positions `start' to `end' of it); membership in the other pools and the
+ * archetype is then a single lookup of the entity signature
+ * Sorted pools make most entities adjacent both in the pools and in chunks,
+ * so they are passed over in views of many rows like non-sparse systems get
+ */
+static void
+pool_join(EntityManager *emgr, uint32_t mask, size_t start, size_t end,
+	void (*fn)(EntityManager *, Components *, void *), void *ctx)
+{
+	int id;
+	size_t i, n, row;
+	Pool *p;
+	Components v;
+
+	if (!(p = pool_smallest(emgr, mask)))
+		return;
+	if (end > p->n)
+		end = p->n;
+	for (i = start; i < end; i += n) {
+		n = 1;
+		id = p->ids[i];
+		if ((emgr->entities.mask[INDEX(id)] & mask) != mask)
+			continue;
+		while (i + n < end && pool_adjacent(emgr, mask, id, p->ids[i + n], n))
+			++n;
+		row = emgr->entities.row[INDEX(id)];
+		components_slice(&emgr->entities.arch[INDEX(id)]->chunks[row / CHUNK_SIZE]->c,
+			row % CHUNK_SIZE, n, &v);
+		v.anim = mask & COMPONENT_ANIM ? pool_get(&emgr->pools[COLUMN_ANIM], id) : NULL;
+		fn(emgr, &v, ctx);
+	}
+}
+
+static Chunk *
+chunk_create(uint32_t mask)
+{
+	Chunk *ch;
+	size_t c, z;
+	char *p;
+
+	ch = calloc(sizeof(Chunk), 1);
+	if (!ch)
+		return NULL;
+	mask = COLUMNS(mask);
+	z = ALIGN(sizeof(int) * CHUNK_SIZE);
+	for (c = 0; c < NCOLUMNS; ++c)
+		if (mask & 1 << c)
+			z += ALIGN(column_size[c] * CHUNK_SIZE);
+	ch->mem = malloc(z + CACHE_LINE - 1);
+	if (!ch->mem) {
+		free(ch);
+		return NULL;
+	}
+	p = (char *)ALIGN((uintptr_t)ch->mem);
+	ch->c.ids = (int *)p;
+	p += ALIGN(sizeof(int) * CHUNK_SIZE);
+	for (c = 0; c < NCOLUMNS; ++c) {
+		if (!(mask & 1 << c) || !column_size[c])
+			continue;
+		ch->col[c] = p;
+		p += ALIGN(column_size[c] * CHUNK_SIZE);
+	}
+	ch->c.dim = ch->col[COLUMN_DIM];
+	ch->c.pos = ch->col[COLUMN_POS];
+	ch->c.prev = ch->col[COLUMN_PREV];
+	ch->c.vel = ch->col[COLUMN_VEL];
+	ch->c.acc = ch->col[COLUMN_ACC];
+	ch->c.zpos = ch->col[COLUMN_ZPOS];
+	ch->c.sprite = ch->col[COLUMN_SPRITE];
+	ch->c.anim = ch->col[COLUMN_ANIM];
+	ch->c.text = ch->col[COLUMN_TEXT];
+	ch->c.collider = ch->col[COLUMN_COLLIDER];
+
+	return ch;
+}
+
+static void
+chunk_destroy(Chunk *ch)
+{
+	free(ch->mem);
+	free(ch);
+}
+
+/**
+ * Find an archetype of given signature or create a new one
+ */
+static Archetype *
+archetype_get(EntityManager *emgr, uint32_t mask)
+{
+	size_t i;
+	Archetype *a, **tab;
+
+	for (i = 0; i < emgr->narchetypes; ++i)
+		if (emgr->archetypes[i]->mask == mask)
+			return emgr->archetypes[i];
+	tab = realloc(emgr->archetypes, sizeof(Archetype *) * (emgr->narchetypes + 1));
+	a = calloc(sizeof(Archetype), 1);
+	if (!tab || !a)
+		LOG_FATAL("failed allocating a new archetype");
+	a->mask = mask;
+	a->index = emgr->narchetypes;
+	tab[emgr->narchetypes++] = a;
+	emgr->archetypes = tab;
+	for (i = 0; i < NSYSTEMS; ++i)
+		query_add(&emgr->queries[i], a);
+	for (i = 0; i < NRENDERSYSTEMS; ++i)
+		query_add(&emgr->render_queries[i], a);
+	query_add(&emgr->statics, a);
+	LOG_TRACE("created archetype %#x", mask);
+
+	return a;
+}
+
+/**
+ * Append entity `id' at the end of archetype storage, growing it by
+ * a chunk if needed
  */
 static size_t
-entity_get_subset(const EntityManager *emgr, int *buf, size_t len, uint32_t mask)
+archetype_push(EntityManager *emgr, Archetype *a, int id)
+{
+	int c;
+	size_t row, r;
+	Chunk *ch, **chunks;
+
+	row = a->n;
+	if (row == a->nchunks * CHUNK_SIZE) {
+		chunks = realloc(a->chunks, sizeof(Chunk *) * (a->nchunks + 1));
+		if (!chunks || !(chunks[a->nchunks] = chunk_create(a->mask)))
+			LOG_FATAL("failed allocating a chunk for archetype %#x", a->mask);
+		a->chunks = chunks;
+		++a->nchunks;
+	}
+	ch = a->chunks[row / CHUNK_SIZE];
+	r = row % CHUNK_SIZE;
+	for (c = 0; c < NCOLUMNS; ++c)
+		if (ch->col[c])
+			memset((char *)ch->col[c] + column_size[c] * r, 0, column_size[c]);
+	ch->c.ids[r] = id;
+	++ch->c.n;
+	++a->n;
+	emgr->pools_dirty = 1;
+	emgr->entities.arch[INDEX(id)] = a;
+	emgr->entities.row[INDEX(id)] = row;
+
+	return row;
+}
+
+/**
+ * Remove a row from the archetype by moving the last row in its place
+ */
+static void
+archetype_remove(EntityManager *emgr, Archetype *a, size_t row)
 {
-	size_t i, n;
+	int c, moved;
+	size_t last;
+	Chunk *dst, *src;
 
-	n = 0;
-	for (i = 0; i < emgr->entities.n; ++i) {
-		if (n+1 > len)
-			LOG_FATAL("entity id buffer exceeded");
-		if (emgr->entities.exists[i] && (emgr->entities.components[i] & mask) == mask)
-			buf[n++] = i;
+	last = a->n - 1;
+	dst = a->chunks[row / CHUNK_SIZE];
+	src = a->chunks[last / CHUNK_SIZE];
+	if (row != last) {
+		for (c = 0; c < NCOLUMNS; ++c)
+			if (dst->col[c])
+				memcpy((char *)dst->col[c] + column_size[c] * (row % CHUNK_SIZE),
+					(char *)src->col[c] + column_size[c] * (last % CHUNK_SIZE),
+					column_size[c]);
+		moved = src->c.ids[last % CHUNK_SIZE];
+		dst->c.ids[row % CHUNK_SIZE] = moved;
+		emgr->entities.row[INDEX(moved)] = row;
 	}
+	--src->c.n;
+	--a->n;
+	emgr->pools_dirty = 1;
+}
+
+/**
+ * Get address of a component of an entity or NULL if the entity
+ * does not have one
+ */
+static void *
+entity_slot(const EntityManager *emgr, int id, int c)
+{
+	size_t row;
+	const Archetype *a;
+
+	if (SPARSE_COMPONENTS & 1 << c)
+		return pool_get(&emgr->pools[c], id);
+	a = emgr->entities.arch[INDEX(id)];
+	row = emgr->entities.row[INDEX(id)];
+	if (!a || !(COLUMNS(a->mask) & 1 << c) || !column_size[c])
+		return NULL;
+	return (char *)a->chunks[row / CHUNK_SIZE]->col[c] + column_size[c] * (row % CHUNK_SIZE);
+}
+
+/**
+ * Get a view of `n' rows of `c' starting at `offs'
+ */
+static void
+components_slice(const Components *c, size_t offs, size_t n, Components *v)
+{
+	v->n = n;
+	v->ids = c->ids + offs;
+	v->dim = c->dim ? c->dim + offs : NULL;
+	v->pos = c->pos ? c->pos + offs : NULL;
+	v->prev = c->prev ? c->prev + offs : NULL;
+	v->vel = c->vel ? c->vel + offs : NULL;
+	v->acc = c->acc ? c->acc + offs : NULL;
+	v->zpos = c->zpos ? c->zpos + offs : NULL;
+	v->sprite = c->sprite ? c->sprite + offs : NULL;
+	v->anim = c->anim ? c->anim + offs : NULL;
+	v->text = c->text ? c->text + offs : NULL;
+	v->collider = c->collider ? c->collider + offs : NULL;
+}
+
+/* `pool_join' callback running a system over a run of entities */
+static void
+entity_run_system(EntityManager *emgr, Components *v, void *ctx)
+{
+	SystemCtx *sys;
+
+	sys = ctx;
+	sys->fn(sys->state, v);
+	++sys->calls;
+	sys->rows += v->n;
+}
+
+/**
+ * Store entity `id' in the archetype of its signature and fill in its
+ * components
+ */
+static void
+entity_place(EntityManager *emgr, int id, const EntityInfo *e)
+{
+	int c;
+	Archetype *a;
+	Vec2 *v;
+	Sprite *s;
+	Text *txt;
+	Collider *col;
+	int *z;
 
-	return n;
+	emgr->entities.mask[INDEX(id)] = e->components;
+	if (e->components & COMPONENT_STATIC)
+		emgr->statics_dirty = 1;
+	a = archetype_get(emgr, e->components & ~SPARSE_COMPONENTS);
+	archetype_push(emgr, a, id);
+	for (c = 0; c < NCOMPONENTS; ++c)
+		if (e->components & SPARSE_COMPONENTS & 1 << c)
+			pool_insert(&emgr->pools[c], id);
+	/* component data is zeroed on push; fill in what the info provides */
+	if ((v = entity_slot(emgr, id, COLUMN_POS))) {
+		v->x = e->x;
+		v->y = e->y;
+		*(Vec2 *)entity_slot(emgr, id, COLUMN_PREV) = *v;
+	}
+	if ((v = entity_slot(emgr, id, COLUMN_DIM))) {
+		v->x = e->w;
+		v->y = e->h;
+	}
+	if ((v = entity_slot(emgr, id, COLUMN_VEL))) {
+		v->x = e->vx;
+		v->y = e->vy;
+	}
+	if ((z = entity_slot(emgr, id, COLUMN_ZPOS)))
+		*z = e->z;
+	if ((s = entity_slot(emgr, id, COLUMN_SPRITE)))
+		s->id = e->sprite;
+	if ((txt = entity_slot(emgr, id, COLUMN_TEXT)) && e->txt) {
+		/* animated text is revealed gradually */
+		txt->len = e->components & COMPONENT_ANIM ? 1 : strlen(e->txt);
+		txt->str = e->txt;
+		txt->font = e->sprite;
+	}
+	if ((col = entity_slot(emgr, id, COLUMN_COLLIDER))) {
+		col->layer = e->layer;
+		col->mask = e->mask;
+	}
 }
 
+/**
+ * Queue a structural change to be applied once systems stop iterating
+ * archetype chunks
+ */
+static int
+entity_defer(EntityManager *emgr, int id, int op, uint32_t mask, const EntityInfo *e)
+{
+	size_t cap;
+	void *p;
+
+	if (emgr->npending == emgr->pendingcap) {
+		cap = emgr->pendingcap ? emgr->pendingcap * 2 : 16;
+		p = realloc(emgr->pending, sizeof(*emgr->pending) * cap);
+		if (!p) {
+			LOG_ERROR("failed deferring a change of entity #%d", id);
+			return 0;
+		}
+		emgr->pending = p;
+		emgr->pendingcap = cap;
+	}
+	emgr->pending[emgr->npending].id = id;
+	emgr->pending[emgr->npending].op = op;
+	emgr->pending[emgr->npending].mask = mask;
+	if (e)
+		emgr->pending[emgr->npending].info = *e;
+	++emgr->npending;
+
+	return 1;
+}
+
+static void
+entity_flush(EntityManager *emgr)
+{
+	size_t i, slot;
+	int id;
+
+	for (i = 0; i < emgr->npending; ++i) {
+		id = emgr->pending[i].id;
+		switch (emgr->pending[i].op) {
+		case PENDING_SPAWN:
+			/* reserved slots past the table come in order */
+			slot = INDEX(id);
+			if (slot == emgr->entities.n) {
+				if (emgr->entities.n == emgr->entities.cap)
+					entities_grow(&emgr->entities);
+				emgr->entities.gen[slot] = 0;
+				++emgr->entities.n;
+				--emgr->nreserved;
+			}
+			entity_place(emgr, id, &emgr->pending[i].info);
+			break;
+		case PENDING_DELETE:
+			entity_delete(emgr, id);
+			break;
+		default:
+			entity_set_components(emgr, id, emgr->pending[i].mask);
+		}
+	}
+	emgr->npending = 0;
+}
+
+/**
+ * Pass boxes of all static colliders over to collision detection
+ */
+static void
+entity_sync_statics(EntityManager *emgr, Collisions *col)
+{
+	size_t i, j, k;
+	Components *c;
+
+	collisions_clear_static(col);
+	for (i = 0; i < emgr->statics.n; ++i) {
+		for (j = 0; j < emgr->statics.arch[i]->nchunks; ++j) {
+			c = &emgr->statics.arch[i]->chunks[j]->c;
+			for (k = 0; k < c->n; ++k)
+				collisions_add_static(col, c->ids[k],
+					c->pos[k].x, c->pos[k].y, c->dim[k].x, c->dim[k].y,
+					c->collider[k].layer, c->collider[k].mask);
+		}
+	}
+	emgr->statics_dirty = 0;
+}
+
+/**
+ * Check whether a system has any entities to process
+ */
+static int
+system_active(const EntityManager *emgr, int sys)
+{
+	int c;
+	size_t i;
+	uint32_t mask;
+
+	mask = systems_vtable[sys].mask;
+	if (mask & SPARSE_COMPONENTS) {
+		for (c = 0; c < NCOMPONENTS; ++c)
+			if (mask & SPARSE_COMPONENTS & 1 << c && !emgr->pools[c].n)
+				return 0;
+		return 1;
+	}
+	for (i = 0; i < emgr->queries[sys].n; ++i)
+		if (emgr->queries[sys].arch[i]->n)
+			return 1;
+	return 0;
+}
+
+/**
+ * Check whether a system moves entities of an archetype
+ * Systems writing positions keep where entities were at the start of the
+ * tick in `prev' themselves, for rendering in between ticks; positions of
+ * entities left alone stay where they were.
+ */
+static int
+system_moves(const Archetype *a)
+{
+	int i;
+	uint32_t mask;
+
+	for (i = 0; i < NSYSTEMS; ++i) {
+		mask = systems_vtable[i].mask & ~SPARSE_COMPONENTS;
+		if (systems_vtable[i].write & COMPONENT_POS && (a->mask & mask) == mask
+				&& !(a->mask & systems_vtable[i].exclude))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Systems conflict if either of them writes components the other one
+ * accesses
+ */
+static int
+system_conflict(int a, int b)
+{
+	return systems_vtable[a].write & (systems_vtable[b].read | systems_vtable[b].write)
+		|| systems_vtable[b].write & systems_vtable[a].read;
+}
+
+/**
+ * Split entities of a data-parallel system into batches
+ * Returns the amount of batches or 0 if the system is not worth splitting
+ */
+static size_t
+system_split(EntityManager *emgr, GameState *state, int sys)
+{
+	size_t i, j, k, total, n, cap;
+	Archetype *a;
+	Components *c;
+	Pool *p;
+	BatchJob *b;
+
+	p = NULL;
+	total = n = 0;
+	if (systems_vtable[sys].mask & SPARSE_COMPONENTS) {
+		p = pool_smallest(emgr, systems_vtable[sys].mask);
+		total = p ? p->n : 0;
+		n = (total + PARALLEL_BATCH - 1) / PARALLEL_BATCH;
+	} else {
+		for (j = 0; j < emgr->queries[sys].n; ++j) {
+			a = emgr->queries[sys].arch[j];
+			total += a->n;
+			for (k = 0; k < a->nchunks; ++k)
+				n += (a->chunks[k]->c.n + PARALLEL_BATCH - 1) / PARALLEL_BATCH;
+		}
+	}
+	if (total < PARALLEL_THRESHOLD)
+		return 0;
+	if (n > emgr->batches[sys].cap) {
+		cap = emgr->batches[sys].cap ? emgr->batches[sys].cap : 16;
+		while (cap < n)
+			cap *= 2;
+		b = realloc(emgr->batches[sys].d, sizeof(BatchJob) * cap);
+		if (!b) {
+			LOG_ERROR("failed allocating batches; running system #%d serially", sys);
+			return 0;
+		}
+		emgr->batches[sys].d = b;
+		emgr->batches[sys].cap = cap;
+	}
+	b = emgr->batches[sys].d;
+	if (p) {
+		for (i = 0; i < n; ++i) {
+			b[i].state = state;
+			b[i].sys = sys;
+			b[i].start = i * PARALLEL_BATCH;
+			b[i].end = b[i].start + PARALLEL_BATCH;
+		}
+		return n;
+	}
+	for (i = j = 0; j < emgr->queries[sys].n; ++j) {
+		a = emgr->queries[sys].arch[j];
+		for (k = 0; k < a->nchunks; ++k) {
+			c = &a->chunks[k]->c;
+			for (total = 0; total < c->n; total += PARALLEL_BATCH, ++i) {
+				b[i].state = state;
+				b[i].sys = sys;
+				components_slice(c, total,
+					c->n - total < PARALLEL_BATCH ? c->n - total : PARALLEL_BATCH,
+					&b[i].c);
+			}
+		}
+	}
+
+	return i;
+}
+
+static void
+batch_run(void *ctx)
+{
+	BatchJob *b;
+	SystemCtx sys;
+
+	b = ctx;
+	if (systems_vtable[b->sys].mask & SPARSE_COMPONENTS) {
+		sys.state = b->state;
+		sys.fn = systems_vtable[b->sys].fn;
+		sys.calls = sys.rows = 0;
+		pool_join(b->state->entity_manager, systems_vtable[b->sys].mask,
+			b->start, b->end, entity_run_system, &sys);
+		b->calls = sys.calls;
+		b->rows = sys.rows;
+		return;
+	}
+	systems_vtable[b->sys].fn(b->state, &b->c);
+	b->calls = 1;
+	b->rows = b->c.n;
+}
+
+static void
+system_run(void *ctx)
+{
+	size_t j, k;
+	Archetype *a;
+	EntityManager *emgr;
+	SystemJob *job;
+	SystemCtx sys;
+
+	job = ctx;
+	emgr = job->state->entity_manager;
+	job->calls = job->rows = 0;
+	if (systems_vtable[job->sys].flags & SYSTEM_PARALLEL_FOR && job->state->workers
+		&& (k = system_split(emgr, job->state, job->sys))) {
+		workers_parallel_for(job->state->workers, batch_run,
+			emgr->batches[job->sys].d, sizeof(BatchJob), k);
+		for (j = 0; j < k; ++j) {
+			job->calls += emgr->batches[job->sys].d[j].calls;
+			job->rows += emgr->batches[job->sys].d[j].rows;
+		}
+		return;
+	}
+	if (systems_vtable[job->sys].mask & SPARSE_COMPONENTS) {
+		sys.state = job->state;
+		sys.fn = systems_vtable[job->sys].fn;
+		sys.calls = sys.rows = 0;
+		pool_join(emgr, systems_vtable[job->sys].mask, 0, SIZE_MAX, entity_run_system, &sys);
+		job->calls = sys.calls;
+		job->rows = sys.rows;
+		return;
+	}
+	for (j = 0; j < emgr->queries[job->sys].n; ++j) {
+		a = emgr->queries[job->sys].arch[j];
+		for (k = 0; k < a->nchunks; ++k) {
+			if (!a->chunks[k]->c.n)
+				continue;
+			systems_vtable[job->sys].fn(job->state, &a->chunks[k]->c);
+			++job->calls;
+			job->rows += a->chunks[k]->c.n;
+		}
+	}
+}
+
+/**
+ * Run all the systems for a single tick
+ * Systems are run in waves: a system joins a wave once all earlier systems
+ * (in vtable order) it conflicts with are done, so the result is the same
+ * as running them one by one
+ */
 void
 process_tick(GameState *state)
 {
-	int i, ids[MAX_ENTITIES];
-	size_t cnt;
+	int i, j;
+	uint32_t deps[NSYSTEMS], pending, active, wave;
+	EntityManager *emgr;
+	Workers *workers;
+	SystemJob jobs[NSYSTEMS];
 
+	emgr = state->entity_manager;
+	workers = state->workers;
+	if (emgr->pools_dirty) {
+		for (i = 0; i < NCOMPONENTS; ++i)
+			if (SPARSE_COMPONENTS & 1 << i)
+				pool_sort(emgr, &emgr->pools[i]);
+		emgr->pools_dirty = 0;
+	}
+	++emgr->lock;
+	/* build dependency graph of systems having anything to do this tick */
+	pending = 0;
+	for (i = 0; i < NSYSTEMS; ++i) {
+		if (!system_active(emgr, i))
+			continue;
+		deps[i] = 0;
+		for (j = 0; j < i; ++j)
+			if (pending & 1 << j && system_conflict(j, i))
+				deps[i] |= 1 << j;
+		pending |= 1 << i;
+		jobs[i].state = state;
+		jobs[i].sys = i;
+	}
+	active = pending;
+	while (pending) {
+		wave = 0;
+		for (i = 0; i < NSYSTEMS; ++i)
+			if (pending & 1 << i && !(deps[i] & pending))
+				wave |= 1 << i;
+		for (i = 0; i < NSYSTEMS; ++i)
+			if (wave & 1 << i && workers && !(systems_vtable[i].flags & SYSTEM_MAIN_THREAD))
+				workers_submit(workers, system_run, &jobs[i]);
+		for (i = 0; i < NSYSTEMS; ++i)
+			if (wave & 1 << i && (!workers || systems_vtable[i].flags & SYSTEM_MAIN_THREAD))
+				system_run(&jobs[i]);
+		if (workers)
+			workers_wait(workers);
+		pending &= ~wave;
+	}
+	memset(&emgr->stats, 0, sizeof(EntityStats));
 	for (i = 0; i < NSYSTEMS; ++i) {
-		cnt = entity_get_subset(state->entity_manager, &ids[0], MAX_ENTITIES, systems_vtable[i].mask);
-		systems_vtable[i].fn(state, ids, cnt);
+		if (!(active & 1 << i))
+			continue;
+		emgr->stats.calls += jobs[i].calls;
+		emgr->stats.rows += jobs[i].rows;
+	}
+	/* entities deleted by collision handlers stay valid until all of the
+	 * handlers are done */
+	if (state->collisions) {
+		if (emgr->statics_dirty)
+			entity_sync_statics(emgr, state->collisions);
+		collisions_update(state->collisions);
 	}
+	--emgr->lock;
+	entity_flush(emgr);
+}
+
+/**
+ * Get how many times systems were called by the last tick and how many
+ * entities they were given in total
+ */
+void
+entity_get_stats(const EntityManager *emgr, EntityStats *stats)
+{
+	*stats = emgr->stats;
 }
 
+/**
+ * Record drawing of entities `alpha' of the way from where they were at
+ * the start of the last tick to where it left them
+ */
 void
-process_rendering(GameState *state)
+process_rendering(GameState *state, CmdList *cl, float alpha)
 {
-	int i, ids[MAX_ENTITIES];
-	size_t cnt;
+	int i;
+	size_t j, k;
+	Archetype *a;
+	EntityManager *emgr;
 
+	emgr = state->entity_manager;
+	cmd_set_camera(cl, &state->camera);
+	cmd_batch_begin(cl);
+	if (state->tilemap)
+		tilemap_render(state->tilemap, cl);
+	++emgr->lock;
 	for (i = 0; i < NRENDERSYSTEMS; ++i) {
-		cnt = entity_get_subset(state->entity_manager, &ids[0], MAX_ENTITIES, render_systems_vtable[i].mask);
-		render_systems_vtable[i].fn(state->entity_manager, state->gc, ids, cnt);
+		for (j = 0; j < emgr->render_queries[i].n; ++j) {
+			a = emgr->render_queries[i].arch[j];
+			for (k = 0; k < a->nchunks; ++k)
+				if (a->chunks[k]->c.n)
+					render_systems_vtable[i].fn(emgr, cl, &a->chunks[k]->c, alpha);
+		}
 	}
+	cmd_batch_flush(cl);
+	--emgr->lock;
+	entity_flush(emgr);
 }
 
 static void
-entity_render(EntityManager *emgr, Gc *gc, int *ids, size_t cnt)
+entity_render_sprites(EntityManager *emgr, CmdList *cl, Components *c, float alpha)
 {
-	int i, nbg, nfg, bg[MAX_ENTITIES], fg[MAX_ENTITIES];
-
-	/* divide elements into foreground and background groups based on zpos */
-	/* TODO use zbuffer capabilities in renderer instead */
-	nbg = nfg = 0;
-	for (i = 0; i < cnt; ++i)
-		if (emgr->components.zpos[ids[i]]) {
-			fg[nfg++] = ids[i];
-		} else {
-			bg[nbg++] = ids[i];
-		}
+	size_t i;
+	Vec2 p;
 
-	while (nbg--)
-		gc_draw(gc,
-			emgr->components.sprite[bg[nbg]].id,
-			emgr->components.pos[bg[nbg]].x/100,
-			emgr->components.pos[bg[nbg]].y/100,
-			emgr->components.zpos[bg[nbg]],
-			emgr->components.sprite[bg[nbg]].offs_x,
-			emgr->components.sprite[bg[nbg]].offs_y);
-	while (nfg--)
-		gc_draw(gc,
-			emgr->components.sprite[fg[nfg]].id,
-			emgr->components.pos[fg[nfg]].x/100,
-			emgr->components.pos[fg[nfg]].y/100,
-			emgr->components.zpos[fg[nfg]],
-			emgr->components.sprite[fg[nfg]].offs_x,
-			emgr->components.sprite[fg[nfg]].offs_y);
+	for (i = 0; i < c->n; ++i) {
+		p = entity_lerp(c, i, alpha);
+		if (cmd_visible(cl, c->sprite[i].id, p.x/100, p.y/100))
+			cmd_queue_push(cl,
+				c->sprite[i].id,
+				p.x/100,
+				p.y/100,
+				c->zpos[i],
+				c->sprite[i].offs_x,
+				c->sprite[i].offs_y);
+	}
 }
 
 static void
-entity_render_texts(EntityManager *emgr, Gc *gc, int *ids, size_t cnt)
+entity_render_texts(EntityManager *emgr, CmdList *cl, Components *c, float alpha)
 {
-	int i, id;
+	size_t i;
+	Vec2 p;
 
-	for (i = 0; i < cnt; ++i) {
-		id = ids[i];
-		gc_print(gc,
-			emgr->components.text[id].font,
-			emgr->components.pos[id].x / 100,
-			emgr->components.pos[id].y / 100,
+	for (i = 0; i < c->n; ++i) {
+		p = entity_lerp(c, i, alpha);
+		cmd_print(cl,
+			c->text[i].font,
+			p.x / 100,
+			p.y / 100,
 			5, /* TODO zpos rework */
-			emgr->components.text[id].str,
-			emgr->components.text[id].len);
+			c->text[i].str,
+			c->text[i].len);
 	}
 }
 
+/**
+ * Get position of row `i' `alpha' of the way through the last tick
+ */
+static Vec2
+entity_lerp(const Components *c, size_t i, float alpha)
+{
+	Vec2 p;
+
+	p.x = c->prev[i].x + (int)((c->pos[i].x - c->prev[i].x) * alpha);
+	p.y = c->prev[i].y + (int)((c->pos[i].y - c->prev[i].y) * alpha);
+	return p;
+}
+
 static void
-entity_accelerate(GameState *state, int *ids, size_t cnt)
+entity_accelerate(GameState *state, Components *c)
 {
-	int i, id;
 	Input user_input;
-	EntityManager *emgr;
 
-	emgr = state->entity_manager;
 	user_input = gc_poll_input();
 	if (user_input.dx && user_input.dy) {
 		user_input.dx *= .7f;
 		user_input.dy *= .7f;
 	}
-	for (i = 0; i < cnt; ++i) {
-		id = ids[i];
-		emgr->components.acc[id].x = 5.f * user_input.dx - (int)(emgr->components.vel[id].x * .005f);
-		emgr->components.acc[id].y = 5.f * user_input.dy - (int)(emgr->components.vel[id].y * .005f);
-	}
+	kin_accelerate((int *)c->acc, (int *)c->vel, c->n, user_input.dx, user_input.dy);
 }
 
 static void
-entity_displace(GameState *state, int *ids, size_t cnt)
+entity_displace(GameState *state, Components *c)
 {
-	int i, id;
-	EntityManager *emgr;
-
-	emgr = state->entity_manager;
-	for (i = 0; i < cnt; ++i) {
-		id = ids[i];
-		emgr->components.vel[id].x = (emgr->components.vel[id].x + emgr->components.acc[id].x) * .9f;
-		emgr->components.vel[id].y = (emgr->components.vel[id].y + emgr->components.acc[id].y) * .9f;
-		emgr->components.pos[id].x += emgr->components.vel[id].x;
-		emgr->components.pos[id].y += emgr->components.vel[id].y;
-	}
+	kin_displace((int *)c->pos, (int *)c->prev, (int *)c->vel, (int *)c->acc, c->n);
 }
 
 static void
-entity_animate_vel(GameState *state, int *ids, size_t cnt)
+entity_animate_vel(GameState *state, Components *c)
 {
-	int i, id;
+	size_t i;
 	Vec2 vel;
-	EntityManager *emgr;
 
-	emgr = state->entity_manager;
-	for (i = 0; i < cnt; ++i) {
-		id = ids[i];
-		vel = emgr->components.vel[id];
+	for (i = 0; i < c->n; ++i) {
+		vel = c->vel[i];
 		if (vel.x == 0 && vel.y == 0) {
-			emgr->components.anim[id][ANIM_FRAME] = 0;
+			c->anim[i][ANIM_FRAME] = 0;
 			continue;
 		}
 		/* eval direction */
 		if (ABS(vel.x) > ABS(vel.y)) {
 			if (vel.x > 0)
-				emgr->components.anim[id][ANIM_DIR] = ANIM_DIR_RIGHT;
+				c->anim[i][ANIM_DIR] = ANIM_DIR_RIGHT;
 			else
-				emgr->components.anim[id][ANIM_DIR] = ANIM_DIR_LEFT;
+				c->anim[i][ANIM_DIR] = ANIM_DIR_LEFT;
 		} else {
 			if (vel.y > 0)
-				emgr->components.anim[id][ANIM_DIR] = ANIM_DIR_DOWN;
+				c->anim[i][ANIM_DIR] = ANIM_DIR_DOWN;
 			else
-				emgr->components.anim[id][ANIM_DIR] = ANIM_DIR_UP;
+				c->anim[i][ANIM_DIR] = ANIM_DIR_UP;
 		}
 		/* eval frame */
-		if (++emgr->components.anim[id][ANIM_TICKS] > ANIM_TICKS_PER_FRAME) {
-			emgr->components.anim[id][ANIM_TICKS] = 0;
-			emgr->components.anim[id][ANIM_FRAME] = (emgr->components.anim[id][ANIM_FRAME] + 1) % ANIM_MAX_FRAMES;
+		if (++c->anim[i][ANIM_TICKS] >= ANIM_TICKS_PER_FRAME) {
+			c->anim[i][ANIM_TICKS] = 0;
+			c->anim[i][ANIM_FRAME] = (c->anim[i][ANIM_FRAME] + 1) % ANIM_MAX_FRAMES;
 		}
 	}
 
 	/* apply offset to the sprite */
-	for (i = 0; i < cnt; ++i) {
-		id = ids[i];
-		emgr->components.sprite[id].offs_x = emgr->components.anim[id][ANIM_FRAME];
-		emgr->components.sprite[id].offs_y = emgr->components.anim[id][ANIM_DIR];
+	for (i = 0; i < c->n; ++i) {
+		c->sprite[i].offs_x = c->anim[i][ANIM_FRAME];
+		c->sprite[i].offs_y = c->anim[i][ANIM_DIR];
 	}
 }
 
 static void
-entity_animate_text(GameState *state, int *ids, size_t cnt)
+entity_animate_text(GameState *state, Components *c)
 {
-	int i, id;
-	size_t slen;
+	size_t i, slen;
 	Text *txt;
-	EntityManager *emgr;
 
-	emgr = state->entity_manager;
-	for (i = 0; i < cnt; ++i) {
-		id = ids[i];
-		txt = &emgr->components.text[id];
+	for (i = 0; i < c->n; ++i) {
+		txt = &c->text[i];
 
-		if (++emgr->components.anim[id][0] <= ANIM_TEXT_TICKS_PER_FRAME)
+		if (++c->anim[i][0] < ANIM_TEXT_TICKS_PER_FRAME)
 			continue;
 
-		emgr->components.anim[id][0] = 0;
+		c->anim[i][0] = 0;
 		txt->len += ANIM_TEXT_CHARS_PER_FRAME;
 		audio_play(state->audio, ANIM_TEXT_SOUND, 1.f);
 
 		slen = strlen(txt->str);
 		if (txt->len >= slen) { /* animation is finished */
 			txt->len = slen;
-			emgr->entities.components[id] ^= COMPONENT_ANIM;
-			LOG_TRACE("finished animating text #%d", id);
+			/* applied after all the systems are done with this tick */
+			entity_set_components(state->entity_manager, c->ids[i],
+				state->entity_manager->entities.mask[INDEX(c->ids[i])] & ~COMPONENT_ANIM);
+			LOG_TRACE("finished animating text #%d", c->ids[i]);
 		}
 	}
 }
 
-/**
- * A temporary function for backwards compat with previous entity system
- * TODO replace with a general purpose collision system
- */
-int
-entity_detect_collision(EntityManager *emgr, int first, int second, void (*fn)(int, int, void *), void *ctx)
+static void
+entity_collide(GameState *state, Components *c)
 {
-	uint32_t mask;
-	Vec2 first_pos, first_dim, second_pos, second_dim;
-
-	/* check if entities are valid */
-	if (!emgr->entities.exists[first] || !emgr->entities.exists[second])
-		return -1;
-	mask = (COMPONENT_POS | COMPONENT_DIM);
-	if ((emgr->entities.components[first] & mask) != mask
-		|| (emgr->entities.components[second] & mask) != mask)
-		return -1;
+	size_t i;
 
-	first_pos = emgr->components.pos[first];
-	second_pos = emgr->components.pos[second];
-	first_dim = emgr->components.dim[first];
-	second_dim = emgr->components.dim[second];
-
-	if (first_pos.x < second_pos.x + second_dim.x &&
-		first_pos.x + first_dim.x > second_pos.x &&
-		first_pos.y < second_pos.y + second_dim.y &&
-		first_pos.y + first_dim.x > second_pos.y) {
-		if (fn)
-			fn(first, second, ctx);
-		return 1;
-	}
-
-	return 0;
+	if (!state->collisions)
+		return;
+	for (i = 0; i < c->n; ++i)
+		collisions_add(state->collisions, c->ids[i],
+			c->pos[i].x, c->pos[i].y, c->dim[i].x, c->dim[i].y,
+			c->collider[i].layer, c->collider[i].mask);
 }
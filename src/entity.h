@@ -35,31 +35,49 @@ enum component {
 	COMPONENT_SPRITE  = 1 << 5,
 	COMPONENT_ANIM    = 1 << 6,
 	COMPONENT_TEXT    = 1 << 7,
-	COMPONENT_INPUT   = 1 << 8
+	COMPONENT_INPUT   = 1 << 8,
+	COMPONENT_COLLIDER = 1 << 9,
+	COMPONENT_STATIC  = 1 << 10  /* never moves once spawned */
 };
 
+#define TICK_RATE 120 /* ticks simulated per second */
+
 typedef struct entity_manager EntityManager;
 typedef struct game_state GameState;
+struct cmd_list;
 struct game_state {
 	GameState *prev;
 	Gc *gc;
 	Audio *audio;
 	EntityManager *entity_manager;
+	struct workers *workers; /* NULL to run systems on the calling thread */
+	struct collisions *collisions; /* NULL to skip collision detection */
+	struct tilemap *tilemap; /* NULL for no map */
+	Camera camera; /* view of the world, in drawing coordinates */
 };
 
 typedef struct {
 	enum component components;
 	int x, y, z, w, h, sprite;
-	const char *txt;
+	int vx, vy; /* velocity */
+	uint32_t layer, mask; /* collision layer and layers it collides with */
+	const char *txt; /* printed in font `sprite' */
 } EntityInfo;
 
+/* system calls made by the last tick and entities passed to them */
+typedef struct {
+	unsigned long calls, rows;
+} EntityStats;
+
 EntityManager * create_entity_manager(void);
 void destroy_entity_manager(EntityManager *);
 int entity_spawn(EntityManager *, EntityInfo);
 int entity_spawn_text(EntityManager *, int, int, int, const char *, int);
 int entity_get_info(EntityManager *, int, EntityInfo *);
+int entity_set_components(EntityManager *, int, enum component);
 void entity_delete(EntityManager *, int);
+int entity_valid(const EntityManager *, int);
+void entity_get_stats(const EntityManager *, EntityStats *);
 void process_tick(GameState *);
-void process_rendering(GameState *);
+void process_rendering(GameState *, struct cmd_list *, float);
 
-int entity_detect_collision(EntityManager *, int, int, void (*fn)(int, int, void *), void *);
@@ -57,16 +57,29 @@ typedef struct {
 
 static int snd_read_header(Stream *, SndHdr *);
 
+static const size_t channel_size[] = {
+	sizeof(uint8_t), /* IMAGE_RGBA8 */
+	sizeof(uint16_t), /* IMAGE_RGBA16 */
+	sizeof(float) /* IMAGE_FLOAT */
+};
+
+/**
+ * Load a farbfeld image, decoding pixels to `fmt'
+ */
 Image *
-ff_load(const char *path)
+ff_load(const char *path, enum image_format fmt)
 {
 	Stream *s;
 	uint8 hdr[16];
-	uint16 *rowbuf;
-	usize rowsiz, i, j, offs, cur;
+	uint16 *rowbuf, v;
+	usize rowsiz, i, j, cur;
 	Image *img;
 
 	LOG_DEBUG("loading image asset: %s", path);
+	if ((unsigned int)fmt >= sizeof(channel_size) / sizeof(channel_size[0])) {
+		LOG_ERROR("unknown image format %d", (int)fmt);
+		return nil;
+	}
 	if ((s = io_open(path, IO_RDONLY)) == nil) {
 		LOG_PERROR("couldn't open file");
 		return nil;
@@ -93,7 +106,8 @@ ff_load(const char *path)
 	}
 	*/
 	img->siz = img->w * img->h * 4;
-	if (!(img->d = calloc(sizeof(float), img->siz))) {
+	img->fmt = fmt;
+	if (!(img->d = calloc(channel_size[fmt], img->siz))) {
 		LOG_PERROR("failed to allocate image struct");
 		goto err2;
 	}
@@ -111,12 +125,20 @@ ff_load(const char *path)
 			free(rowbuf);
 			goto err3;
 		}
-		for (j = 0; j < img->w; ++j) {
-			offs = j * 4;
-			img->d[cur++] = (float)ntohs(rowbuf[offs]) / 65536.f;
-			img->d[cur++] = (float)ntohs(rowbuf[offs+1]) / 65536.f;
-			img->d[cur++] = (float)ntohs(rowbuf[offs+2]) / 65536.f;
-			img->d[cur++] = (float)ntohs(rowbuf[offs+3]) / 65536.f;
+		for (j = 0; j < 4 * img->w; ++j, ++cur) {
+			v = ntohs(rowbuf[j]);
+			switch (fmt) {
+			case IMAGE_RGBA8:
+				/* rounded; exact for 8 bit images widened by 257 */
+				((uint8_t *)img->d)[cur] = ((uint32_t)v * 255 + 32767) / 65535;
+				break;
+			case IMAGE_RGBA16:
+				((uint16_t *)img->d)[cur] = v;
+				break;
+			case IMAGE_FLOAT:
+				((float *)img->d)[cur] = (float)v / 65536.f;
+				break;
+			}
 		}
 	}
 
@@ -131,6 +153,34 @@ err1:	io_close(s);
 	return nil;
 }
 
+/**
+ * Check whether an image has pixels neither clear nor opaque; alpha
+ * short of .99 counts as translucent
+ */
+int
+image_translucent(const Image *img)
+{
+	size_t i;
+
+	for (i = 3; i < img->siz; i += 4) {
+		switch (img->fmt) {
+		case IMAGE_RGBA8:
+			if (((uint8_t *)img->d)[i] > 0 && ((uint8_t *)img->d)[i] < 253)
+				return 1;
+			break;
+		case IMAGE_RGBA16:
+			if (((uint16_t *)img->d)[i] > 0 && ((uint16_t *)img->d)[i] < 64880)
+				return 1;
+			break;
+		case IMAGE_FLOAT:
+			if (((float *)img->d)[i] > 0.f && ((float *)img->d)[i] < .99f)
+				return 1;
+			break;
+		}
+	}
+	return 0;
+}
+
 size_t
 snd_load(int16_t **dst, const char *path)
 {
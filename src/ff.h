@@ -1,7 +1,16 @@
+/* layout of `Image.d'; four channels per pixel, RGBA */
+enum image_format {
+	IMAGE_RGBA8, /* uint8_t */
+	IMAGE_RGBA16, /* uint16_t, host byte order */
+	IMAGE_FLOAT /* float in [0, 1) */
+};
+
 typedef struct {
-	size_t w, h, siz;
-	float *d;
+	size_t w, h, siz; /* `siz' counts channels */
+	enum image_format fmt;
+	void *d;
 } Image;
 
-Image * ff_load(const char *);
+Image * ff_load(const char *, enum image_format);
+int image_translucent(const Image *);
 size_t snd_load(int16_t **, const char *);
@@ -0,0 +1,253 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ *
+ * Kinematics kernels
+ * SSE2/AVX2 variants are selected at runtime and give results bit-exact
+ * with the scalar ones: all of them do the same single precision
+ * multiplications and truncate towards zero
+ * Rates are given per second and turned into coefficients of a tick by
+ * `kin_init', integrating them exactly over the tick so bodies move at
+ * the same speed whatever the tick rate.
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define KIN_X86
+# include <immintrin.h>
+#endif /* __GNUC__ && x86 */
+
+#include "log.h"
+#include "kin.h"
+
+#define DAMPING 105.4 /* velocity decay per second; .9 kept every millisecond */
+#define DRAG 5. /* velocity decay per second due to drag */
+#define ACCEL 4.75e6 /* units per second squared at full input */
+
+static void accelerate_scalar(int *, const int *, size_t, float, float);
+static void displace_scalar(int *, int *, int *, const int *, size_t);
+#ifdef KIN_X86
+static void accelerate_sse2(int *, const int *, size_t, float, float);
+static void displace_sse2(int *, int *, int *, const int *, size_t);
+static void accelerate_avx2(int *, const int *, size_t, float, float);
+static void displace_avx2(int *, int *, int *, const int *, size_t);
+#endif /* KIN_X86 */
+
+static void (*accelerate)(int *, const int *, size_t, float, float) = accelerate_scalar;
+static void (*displace)(int *, int *, int *, const int *, size_t) = displace_scalar;
+static KinCoefs coefs;
+
+
+/**
+ * Pick the widest kernels supported by the CPU and set up coefficients of
+ * ticks `tick' seconds long
+ * Velocity decays by `DAMPING + DRAG' towards its terminal value; the
+ * coefficients take a tick of that decay in one step.
+ */
+void
+kin_init(double tick)
+{
+	double rate;
+
+	rate = DAMPING + DRAG;
+	coefs.damping = exp(-DAMPING * tick);
+	coefs.drag = 1. - exp(-DRAG * tick);
+	coefs.accel = ACCEL / rate * (1. - exp(-rate * tick)) * tick / coefs.damping;
+	if (kin_use(KIN_AVX2))
+		LOG_DEBUG("using AVX2 kinematics kernels");
+	else if (kin_use(KIN_SSE2))
+		LOG_DEBUG("using SSE2 kinematics kernels");
+	else if (kin_use(KIN_SCALAR))
+		LOG_DEBUG("using scalar kinematics kernels");
+}
+
+/**
+ * Switch over to kernels `k'
+ * Returns 0 if the CPU does not support them
+ */
+int
+kin_use(enum kin_kernels k)
+{
+	switch (k) {
+#ifdef KIN_X86
+	case KIN_AVX2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("avx2"))
+			return 0;
+		accelerate = accelerate_avx2;
+		displace = displace_avx2;
+		return 1;
+	case KIN_SSE2:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse2"))
+			return 0;
+		accelerate = accelerate_sse2;
+		displace = displace_sse2;
+		return 1;
+#endif /* KIN_X86 */
+	case KIN_SCALAR:
+		accelerate = accelerate_scalar;
+		displace = displace_scalar;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+void
+kin_get_coefs(KinCoefs *c)
+{
+	*c = coefs;
+}
+
+/**
+ * Set acceleration of `n' bodies from user input (`dx', `dy') and drag
+ */
+void
+kin_accelerate(int *acc, const int *vel, size_t n, float dx, float dy)
+{
+	accelerate(acc, vel, n, dx, dy);
+}
+
+/**
+ * Integrate velocity and position of `n' bodies, leaving positions they
+ * had before in `prev'
+ */
+void
+kin_displace(int *pos, int *prev, int *vel, const int *acc, size_t n)
+{
+	displace(pos, prev, vel, acc, n);
+}
+
+static void
+accelerate_scalar(int *acc, const int *vel, size_t n, float dx, float dy)
+{
+	size_t i;
+
+	for (i = 0; i < n * 2; i += 2) {
+		acc[i] = coefs.accel * dx - (int)(vel[i] * coefs.drag);
+		acc[i+1] = coefs.accel * dy - (int)(vel[i+1] * coefs.drag);
+	}
+}
+
+static void
+displace_scalar(int *pos, int *prev, int *vel, const int *acc, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n * 2; ++i) {
+		vel[i] = (vel[i] + acc[i]) * coefs.damping;
+		prev[i] = pos[i];
+		pos[i] += vel[i];
+	}
+}
+
+#ifdef KIN_X86
+__attribute__((target("sse2")))
+static void
+accelerate_sse2(int *acc, const int *vel, size_t n, float dx, float dy)
+{
+	size_t i;
+	__m128 in, drag;
+	__m128i v, d;
+
+	in = _mm_setr_ps(coefs.accel * dx, coefs.accel * dy, coefs.accel * dx, coefs.accel * dy);
+	drag = _mm_set1_ps(coefs.drag);
+	for (i = 0; i + 4 <= n * 2; i += 4) {
+		v = _mm_loadu_si128((const __m128i *)&vel[i]);
+		d = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(v), drag));
+		v = _mm_cvttps_epi32(_mm_sub_ps(in, _mm_cvtepi32_ps(d)));
+		_mm_storeu_si128((__m128i *)&acc[i], v);
+	}
+	accelerate_scalar(&acc[i], &vel[i], n - i / 2, dx, dy);
+}
+
+__attribute__((target("sse2")))
+static void
+displace_sse2(int *pos, int *prev, int *vel, const int *acc, size_t n)
+{
+	size_t i;
+	__m128 damping;
+	__m128i v, p, q;
+
+	damping = _mm_set1_ps(coefs.damping);
+	for (i = 0; i + 4 <= n * 2; i += 4) {
+		v = _mm_add_epi32(_mm_loadu_si128((const __m128i *)&vel[i]),
+			_mm_loadu_si128((const __m128i *)&acc[i]));
+		v = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(v), damping));
+		q = _mm_loadu_si128((const __m128i *)&pos[i]);
+		p = _mm_add_epi32(q, v);
+		_mm_storeu_si128((__m128i *)&vel[i], v);
+		_mm_storeu_si128((__m128i *)&prev[i], q);
+		_mm_storeu_si128((__m128i *)&pos[i], p);
+	}
+	displace_scalar(&pos[i], &prev[i], &vel[i], &acc[i], n - i / 2);
+}
+
+__attribute__((target("avx2")))
+static void
+accelerate_avx2(int *acc, const int *vel, size_t n, float dx, float dy)
+{
+	size_t i;
+	__m256 in, drag;
+	__m256i v, d;
+
+	in = _mm256_setr_ps(coefs.accel * dx, coefs.accel * dy, coefs.accel * dx, coefs.accel * dy,
+		coefs.accel * dx, coefs.accel * dy, coefs.accel * dx, coefs.accel * dy);
+	drag = _mm256_set1_ps(coefs.drag);
+	for (i = 0; i + 8 <= n * 2; i += 8) {
+		v = _mm256_loadu_si256((const __m256i *)&vel[i]);
+		d = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(v), drag));
+		v = _mm256_cvttps_epi32(_mm256_sub_ps(in, _mm256_cvtepi32_ps(d)));
+		_mm256_storeu_si256((__m256i *)&acc[i], v);
+	}
+	accelerate_scalar(&acc[i], &vel[i], n - i / 2, dx, dy);
+}
+
+__attribute__((target("avx2")))
+static void
+displace_avx2(int *pos, int *prev, int *vel, const int *acc, size_t n)
+{
+	size_t i;
+	__m256 damping;
+	__m256i v, p, q;
+
+	damping = _mm256_set1_ps(coefs.damping);
+	for (i = 0; i + 8 <= n * 2; i += 8) {
+		v = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)&vel[i]),
+			_mm256_loadu_si256((const __m256i *)&acc[i]));
+		v = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(v), damping));
+		q = _mm256_loadu_si256((const __m256i *)&pos[i]);
+		p = _mm256_add_epi32(q, v);
+		_mm256_storeu_si256((__m256i *)&vel[i], v);
+		_mm256_storeu_si256((__m256i *)&prev[i], q);
+		_mm256_storeu_si256((__m256i *)&pos[i], p);
+	}
+	displace_scalar(&pos[i], &prev[i], &vel[i], &acc[i], n - i / 2);
+}
+#endif /* KIN_X86 */
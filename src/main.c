@@ -35,16 +35,32 @@
 #include "log.h"
 #include "ff.h"
 #include "render.h"
+#include "cmdlist.h"
+#include "rthread.h"
 #include "audio.h"
 #include "entity.h"
+#include "worker.h"
+#include "collision.h"
+#include "tilemap.h"
 #include "sched.h"
-#include "dict.h"
+#include "pace.h"
 
 #ifdef EMBED_ASSETS
 void vfs_init(void);
 #endif /* EMBED_ASSETS */
 
-#define INTERVAL 0.001
+#define TICK_INTERVAL (1. / TICK_RATE) /* seconds simulated by a tick */
+#define FRAME_RATE 60 /* frames drawn per second at most, unless the display has a known rate */
+#define COLLISION_CELL 6400
+#define TILE_SIZE 6400
+#define MAP_W 20
+#define MAP_H 16
+
+enum layer {
+	LAYER_PLAYER = 1 << 0,
+	LAYER_NPC    = 1 << 1,
+	LAYER_ITEM   = 1 << 2
+};
 
 typedef struct vec2 {
 	int x, y;
@@ -52,14 +68,13 @@ typedef struct vec2 {
 
 static void tick(void);
 static void test_event(unsigned long, void *);
-static void test_collision(int, int, void *);
-static void delete_on_collision(int, int, void *);
+static void test_collision(enum collision_event, const CollisionPair *, size_t, void *);
+static void delete_on_collision(enum collision_event, const CollisionPair *, size_t, void *);
 
 static int main_font;
 static GameState *game_state;
 static Audio *audio;
 static int test_event_ctx;
-static Dict *entity_dict;
 
 int
 main(void)
@@ -67,8 +82,13 @@ main(void)
 	Gc *gc;
 	Image *img;
 	GameState state;
-	int x, y, player, npc;
+	int x, y, rate;
 	EntityInfo e;
+	GcStats stats;
+	RenderThread *render_thread;
+	CmdList *cl;
+	Pacer *pacer;
+	unsigned long n;
 	enum loglvl logging_level;
 
 	logging_level = LOGLVL_TRACE; /* TODO arg parse */
@@ -98,7 +118,8 @@ main(void)
 		LOG_ERROR("failed at allocating graphical context");
 		return 1;
 	}
-	gc_init(gc);
+	gc_init(gc, GC_PROFILE_CORE);
+	gc_set_depth_test(gc, 1);
 	audio_init();
 	audio = audio_create();
 	audio_load(audio, "blip", "assets/blip.snd");
@@ -106,20 +127,23 @@ main(void)
 	state.gc = gc;
 	state.audio = audio;
 	state.prev = NULL;
+	state.camera.x = state.camera.y = 0;
+	state.camera.zoom = 1.f;
+	state.workers = workers_create(0);
+	state.collisions = collisions_create(COLLISION_CELL);
+	if (state.collisions == NULL) {
+		LOG_ERROR("failed at allocating collision world");
+		return 1;
+	}
+	collisions_handle(state.collisions, LAYER_PLAYER, LAYER_NPC, COLLISION_ENTER, test_collision, NULL);
+	collisions_handle(state.collisions, LAYER_PLAYER, LAYER_ITEM, COLLISION_ENTER, delete_on_collision, NULL);
 	state.entity_manager = create_entity_manager();
 	if (state.entity_manager == NULL) {
 		LOG_ERROR("failed at allocating entity manager");
 		return 1;
 	}
-	/* create a dictionary for notable entities */
-	entity_dict = dict_create(DICT_DEFAULT_TABLE_SIZE);
-	if (!entity_dict) {
-		LOG_ERROR("failed to create a dictionary for entities");
-		return 1;
-	}
-
 	memset(&e, 0, sizeof(EntityInfo));
-	img = ff_load("assets/tux.ff.bz2");
+	img = ff_load("assets/tux.ff.bz2", IMAGE_RGBA8);
 	if (!img) {
 		LOG_ERROR("error loading sprite");
 		return 1;
@@ -130,24 +154,26 @@ main(void)
 	free(img);
 	e.x = e.y = 30000;
 	e.z = 5;
-	e.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_VEL | COMPONENT_ACC | COMPONENT_ANIM | COMPONENT_ZPOS | COMPONENT_SPRITE | COMPONENT_INPUT);
-	player = entity_spawn(state.entity_manager, e);
-	dict_put(entity_dict, "player", &player);
+	e.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_VEL | COMPONENT_ACC | COMPONENT_ANIM | COMPONENT_ZPOS | COMPONENT_SPRITE | COMPONENT_INPUT | COMPONENT_COLLIDER);
+	e.layer = LAYER_PLAYER;
+	e.mask = LAYER_NPC | LAYER_ITEM;
+	entity_spawn(state.entity_manager, e);
 
 	/* spawn npc */
 	e.x = 60000;
 	e.y = 20000;
-	e.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_ZPOS | COMPONENT_SPRITE);
-	npc = entity_spawn(state.entity_manager, e);
-	set_collsion(state.entity_manager, player, npc, test_collision, NULL);
+	e.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_ZPOS | COMPONENT_SPRITE | COMPONENT_COLLIDER | COMPONENT_STATIC);
+	e.layer = LAYER_NPC;
+	e.mask = 0;
+	entity_spawn(state.entity_manager, e);
 
-	img = ff_load("assets/sword.ff.bz2");
+	img = ff_load("assets/sword.ff.bz2", IMAGE_RGBA8);
 	test_event_ctx = gc_create_sprite(gc, img, 32, 32);
 	free(img->d);
 	free(img);
 
 	/* load font */
-	img = ff_load("assets/ibm8x16.ff.bz2");
+	img = ff_load("assets/ibm8x16.ff.bz2", IMAGE_RGBA8);
 	if (!img) {
 		LOG_ERROR("error loading sprite");
 		return 1;
@@ -156,39 +182,61 @@ main(void)
 	free(img->d);
 	free(img);
 
-	img = ff_load("assets/grass.ff.bz2");
+	img = ff_load("assets/grass.ff.bz2", IMAGE_RGBA8);
 	if (!img) {
 		LOG_ERROR("error loading sprite");
 		return 1;
 	}
-	e.sprite = gc_create_sprite(gc, img, 64, 64);
-	e.z = 0;
+	state.tilemap = tilemap_create(MAP_W, MAP_H, 1, TILE_SIZE, TILE_SIZE);
+	if (state.tilemap == NULL) {
+		LOG_ERROR("failed at allocating tilemap");
+		return 1;
+	}
+	tilemap_set_tileset(state.tilemap, gc_create_sprite(gc, img, 64, 64), 1);
 	free(img->d);
 	free(img);
-	for (y = 0; y < 16; ++y) {
-		for (x = 0; x < 20; ++x) {
-			e.x = 6400 * x;
-			e.y = 6400 * y;
-			entity_spawn(state.entity_manager, e);
-		}
-	}
+	for (y = 0; y < MAP_H; ++y)
+		for (x = 0; x < MAP_W; ++x)
+			tilemap_set(state.tilemap, 0, x, y, 1);
 
 	gc_bind_input(gc);
 
-	schedule(8000, &test_event, &test_event_ctx);
+	schedule(8 * TICK_RATE, &test_event, &test_event_ctx);
 
 	//gc_set_resolution(gc, 1280, 960);
 	//gc_set_resolution(gc, 960, 720);
+	/* from here on the context belongs to the render thread */
+	render_thread = rthread_create(gc);
+	if (render_thread == NULL) {
+		LOG_ERROR("failed at starting render thread");
+		return 1;
+	}
+	rate = gc_refresh_rate(gc);
+	pacer = pace_create(TICK_INTERVAL, rate > 0 ? rate : FRAME_RATE);
+	if (pacer == NULL)
+		return 1;
 	while (gc_alive(gc)) {
-		while (gc_check_timer(INTERVAL))
+		for (n = pace_ticks(pacer); n; --n)
 			tick();
-		gc_clear(gc);
-		process_rendering(&state);
-		gc_print(gc, main_font, 32, 400, 1, "> Hello world!\n\"The Legend of Tux\"\nZelda-like game test", 0);
-		gc_commit(gc);
+		cl = rthread_list(render_thread);
+		cmd_clear(cl);
+		process_rendering(&state, cl, pace_alpha(pacer));
+		cmd_set_camera(cl, NULL);
+		cmd_print(cl, main_font, 32, 400, 15, "> Hello world!\n\"The Legend of Tux\"\nZelda-like game test", 0);
+		rthread_submit(render_thread);
+		gc_poll_events(gc);
 		audio_flush();
+		pace_wait(pacer);
 	}
+	rthread_destroy(render_thread);
+	pace_destroy(pacer);
 
+	gc_get_stats(gc, &stats);
+	LOG_INFO("GL state changes: %lu issued, %lu skipped as redundant", stats.issued, stats.elided);
+	tilemap_destroy(state.tilemap);
+	collisions_destroy(state.collisions);
+	if (state.workers)
+		workers_destroy(state.workers);
 	audio_exit();
 	return 0;
 }
@@ -198,7 +246,6 @@ tick()
 {
 	static unsigned long ntick = 0;
 	process_tick(game_state);
-	collision_poll(ntick);
 	schedule_poll(++ntick);
 }
 
@@ -206,37 +253,43 @@ static void
 test_event(unsigned long now, void *ctx)
 {
 	EntityInfo e;
-	int *player, item;
+	int item;
 
 	e.sprite = *(int *)ctx;
 	e.z = 5;
-	e.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_ZPOS | COMPONENT_SPRITE);
+	e.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_ZPOS | COMPONENT_SPRITE | COMPONENT_COLLIDER | COMPONENT_STATIC);
+	e.layer = LAYER_ITEM;
+	e.mask = 0;
 	e.x = 70000;
 	e.y = 20000;
 	e.w = e.h = 3800;
 	item = entity_spawn(game_state->entity_manager, e);
-	LOG_INFO("spawned at %zu tick (%d x %d)", now, e.x, e.y);
-	player = dict_lookup(entity_dict, "player");
-	if (!player) {
-		LOG_WARNING("player entity not found");
-		return;
-	}
-	set_collsion(game_state->entity_manager, *player, item, delete_on_collision, NULL);
+	LOG_INFO("spawned #%d at %zu tick (%d x %d)", item, now, e.x, e.y);
 }
 
 static void
-test_collision(int first, int second, void *ctx)
+test_collision(enum collision_event ev, const CollisionPair *pairs, size_t n, void *ctx)
 {
-	LOG_INFO("entity #%d collided with #%d", first, second);
+	static int fired = 0;
+
+	/* greet only on the first encounter */
+	if (fired)
+		return;
+	fired = 1;
+	LOG_INFO("entity #%d collided with #%d", pairs[0].first, pairs[0].second);
 	LOG_INFO("spawned txt %d", entity_spawn_text(game_state->entity_manager, main_font, 40000, 85000, "It's dangerous to go alone.\nTake this!", 38));
 	audio_play(audio, "blip", 1.f);
 }
 
 static void
-delete_on_collision(int first, int second, void *ctx)
+delete_on_collision(enum collision_event ev, const CollisionPair *pairs, size_t n, void *ctx)
 {
-	LOG_INFO("removing entity #%d", second);
-	entity_delete(game_state->entity_manager, second);
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		LOG_INFO("removing entity #%d", pairs[i].second);
+		entity_delete(game_state->entity_manager, pairs[i].second);
+	}
 	audio_play(audio, "blip", 1.f);
 	audio_play(audio, "blip", 1.f);
 	audio_play(audio, "blip", 1.f);
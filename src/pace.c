@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Pace simulation ticks and frames by a monotonic clock
+ * Ticks are fixed steps taken out of the time accumulated since the last
+ * frame. Time beyond `MAX_LAG' is dropped rather than simulated, so a
+ * stall or a pause costs a skipped moment instead of a burst of ticks that
+ * makes the next frame late again. Frames are held to the target rate by
+ * sleeping until shortly before the deadline and spinning the rest, as
+ * sleeps tend to overshoot by a scheduler slice.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef _WIN32
+# include <windows.h>
+#endif /* _WIN32 */
+
+#include "log.h"
+#include "pace.h"
+
+#define MAX_LAG .25 /* seconds of simulation caught up in one frame at most */
+#ifndef _WIN32
+# define SPIN_TAIL .0015 /* seconds before a deadline spent spinning */
+#else
+# define SPIN_TAIL .003 /* default timer resolution is coarser */
+#endif /* _WIN32 */
+
+struct pacer {
+	double tick; /* seconds per tick */
+	double frame; /* seconds per frame; 0 for no limit */
+	double last; /* clock at the last call of `pace_ticks' */
+	double acc; /* time not simulated yet */
+	double deadline; /* of the next frame */
+}; /* type Pacer */
+
+
+/**
+ * Pace ticks of `tick' seconds and frames at `rate' per second; a rate of
+ * 0 leaves frames unlimited, e.g. to be paced by vsync
+ */
+Pacer *
+pace_create(double tick, double rate)
+{
+	Pacer *p;
+
+	if (!(p = malloc(sizeof(Pacer)))) {
+		LOG_PERROR("failed to allocate pacer");
+		return NULL;
+	}
+	p->tick = tick;
+	p->acc = 0.;
+	p->last = p->deadline = pace_clock();
+	pace_set_rate(p, rate);
+
+	return p;
+}
+
+void
+pace_destroy(Pacer *p)
+{
+	free(p);
+}
+
+void
+pace_set_rate(Pacer *p, double rate)
+{
+	p->frame = rate > 0. ? 1. / rate : 0.;
+}
+
+/**
+ * Get the number of ticks due since the last call
+ */
+unsigned long
+pace_ticks(Pacer *p)
+{
+	double now;
+	unsigned long n;
+
+	now = pace_clock();
+	p->acc += now - p->last;
+	p->last = now;
+	if (p->acc > MAX_LAG) {
+		LOG_DEBUG("dropping %.3fs of simulation", p->acc - MAX_LAG);
+		p->acc = MAX_LAG;
+	}
+	n = p->acc / p->tick;
+	p->acc -= n * p->tick;
+	return n;
+}
+
+/**
+ * Get how far into the next tick the time since the last one goes, in
+ * [0, 1)
+ */
+double
+pace_alpha(const Pacer *p)
+{
+	double alpha;
+
+	alpha = p->acc / p->tick;
+	return alpha < 1. ? alpha : 1. - 1e-9;
+}
+
+/**
+ * Wait for the time of the next frame
+ * A frame that came too late is not made up for by the ones after it.
+ */
+void
+pace_wait(Pacer *p)
+{
+	double now;
+
+	if (p->frame <= 0.)
+		return;
+	p->deadline += p->frame;
+	now = pace_clock();
+	if (p->deadline < now - p->frame) {
+		p->deadline = now;
+		return;
+	}
+	pace_sleep_until(p->deadline);
+}
+
+/**
+ * Get time in seconds from an arbitrary point; never goes backwards
+ */
+double
+pace_clock(void)
+{
+#ifndef _WIN32
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+#endif /* _WIN32 */
+}
+
+/**
+ * Sleep until `pace_clock' reaches `t'
+ */
+void
+pace_sleep_until(double t)
+{
+	double left;
+#ifndef _WIN32
+	struct timespec ts;
+#endif /* _WIN32 */
+
+	while ((left = t - pace_clock()) > SPIN_TAIL) {
+		left -= SPIN_TAIL;
+#ifndef _WIN32
+		ts.tv_sec = left;
+		ts.tv_nsec = (left - ts.tv_sec) * 1e9;
+		nanosleep(&ts, NULL);
+#else
+		Sleep(left * 1000.);
+#endif /* _WIN32 */
+	}
+	while (pace_clock() < t)
+		;
+}
@@ -28,6 +28,7 @@
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,47 +37,265 @@
 #include "log.h"
 #include "ff.h"
 #include "render.h"
+#include "atlas.h"
+#include "rqueue.h"
 
 #define SPRITE_LIMIT 512
+#define ATLAS_PAGES 16
+#define ATLAS_SIZE 1024 /* edge of an atlas page; larger sheets get their own */
+#define ATLAS_PADDING 1 /* gap between sheets keeping frames from bleeding */
+#define BATCH_QUADS 2048 /* sprites drawn by a single call at most */
+#define BATCH_VERTEX 6 /* x, y, z, base, u, v */
+#define BATCH_QUAD (6 * BATCH_VERTEX) /* two triangles */
+#define BATCH_INSTANCE 8 /* x, y, frame w, h, frame u, v, z, base */
+#define DEPTH_LAYERS 16 /* zpos values told apart by the depth buffer, as in the shaders */
+#define FLAT (-1e9f) /* base of sprites lying flat at the back of their layer */
+#define ALPHA_CUTOFF .5f /* alpha below which depth tested pixels are dropped */
+#define TEXT_RUNS 64 /* printed strings kept ready for drawing */
+#define CACHE_REGIONS 16 /* screen sized regions of static layers kept drawn */
+#define UNIFORM_SHADOWS 32 /* uniforms whose last values are remembered */
 
 /* SHADERS */
 static const char *vert_shader_src =
 	"#version 120\n"
 	"attribute vec2 position;\n"
-	"attribute vec2 texture;\n"
-	"uniform mat4 tfm;\n"
+	"attribute vec2 uv;\n"
+	"uniform vec4 place;\n" /* translation, scale */
 	"uniform vec2 scale;\n"
 	"uniform vec2 offs;\n"
+	"uniform vec2 origin;\n"
 	"uniform float zpos;\n"
 	"varying vec2 Texcoord;\n"
 	"void main()\n"
 	"{\n"
-	"	Texcoord = texture*scale + offs*scale;\n"
-	"	gl_Position = vec4(position, zpos/10 + position.y/100, 1.0) * tfm;\n"
+	"	Texcoord = origin + uv*scale + offs*scale;\n"
+	"	gl_Position = vec4(position*place.zw + place.xy, zpos, 1.0);\n"
+	"}\n";
+
+/* quads of batched sprites come in drawing coordinates, so that buffers
+ * stay valid when the camera moves
+ * Depth puts higher zpos in front and within a zpos sprites whose lower
+ * edge (`base') is further down the screen */
+static const char *batch_vert_shader_src =
+	"#version 120\n"
+	"attribute vec3 position;\n"
+	"attribute float base;\n"
+	"attribute vec2 uv;\n"
+	"uniform vec2 cam;\n"
+	"uniform vec2 view;\n"
+	"varying vec2 Texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"	float f = clamp((base - cam.y)*view.y*0.5, 0.0, 0.999);\n"
+	"	Texcoord = uv;\n"
+	"	gl_Position = vec4(-1.0 + (position.x - cam.x)*view.x,\n"
+	"		1.0 - (position.y - cam.y)*view.y,\n"
+	"		1.0 - (clamp(position.z, 0.0, 15.0) + f)/8.0, 1.0);\n"
+	"}\n";
+
+/* instanced sprites; a unit quad is stretched over a frame of the texture
+ * given per instance in pixels */
+static const char *inst_vert_shader_src =
+	"#version 120\n"
+	"attribute vec4 corner;\n"
+	"attribute vec2 pos;\n"
+	"attribute vec2 frame;\n"
+	"attribute vec2 origin;\n"
+	"attribute float zpos;\n"
+	"attribute float base;\n"
+	"uniform vec2 cam;\n"
+	"uniform vec2 view;\n"
+	"uniform vec2 texel;\n"
+	"varying vec2 Texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 p = (pos - cam)*vec2(1.0, -1.0) + corner.xy*frame;\n"
+	"	float f = clamp((base - cam.y)*view.y*0.5, 0.0, 0.999);\n"
+	"	Texcoord = (origin + corner.zw*frame) * texel;\n"
+	"	gl_Position = vec4(vec2(-1.0, 1.0) + p*view,\n"
+	"		1.0 - (clamp(zpos, 0.0, 15.0) + f)/8.0, 1.0);\n"
 	"}\n";
 
 static const char *frag_shader_src =
 	"#version 120\n"
 	"varying vec2 Texcoord;\n"
 	"uniform sampler2D tex;\n"
+	"uniform float cutoff;\n"
 	"void main()\n"
 	"{\n"
 	"	vec4 colour = texture2D(tex, Texcoord);\n"
+	"	if (colour.a <= cutoff)\n"
+	"		discard;\n"
 	"	gl_FragColor = colour;\n"
 	"}\n";
 
+/* core profile counterparts; sprites are always instanced there and
+ * constants of the frame come in a uniform buffer */
+static const char *core_vert_shader_src =
+	"#version 330 core\n"
+	"in vec2 position;\n"
+	"in vec2 uv;\n"
+	"uniform vec4 place;\n"
+	"uniform vec2 scale;\n"
+	"uniform vec2 offs;\n"
+	"uniform vec2 origin;\n"
+	"uniform float zpos;\n"
+	"out vec2 Texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"	Texcoord = origin + uv*scale + offs*scale;\n"
+	"	gl_Position = vec4(position*place.zw + place.xy, zpos, 1.0);\n"
+	"}\n";
+
+static const char *core_inst_vert_shader_src =
+	"#version 330 core\n"
+	"in vec4 corner;\n"
+	"in vec2 pos;\n"
+	"in vec2 frame;\n"
+	"in vec2 origin;\n"
+	"in float zpos;\n"
+	"in float base;\n"
+	"layout(std140) uniform Frame {\n"
+	"	vec2 cam;\n"
+	"	vec2 view;\n"
+	"	float cutoff;\n"
+	"};\n"
+	"uniform vec2 texel;\n"
+	"out vec2 Texcoord;\n"
+	"void main()\n"
+	"{\n"
+	"	vec2 p = (pos - cam)*vec2(1.0, -1.0) + corner.xy*frame;\n"
+	"	float f = clamp((base - cam.y)*view.y*0.5, 0.0, 0.999);\n"
+	"	Texcoord = (origin + corner.zw*frame) * texel;\n"
+	"	gl_Position = vec4(vec2(-1.0, 1.0) + p*view,\n"
+	"		1.0 - (clamp(zpos, 0.0, 15.0) + f)/8.0, 1.0);\n"
+	"}\n";
+
+static const char *core_frag_shader_src =
+	"#version 330 core\n"
+	"in vec2 Texcoord;\n"
+	"out vec4 colour;\n"
+	"uniform sampler2D tex;\n"
+	"layout(std140) uniform Frame {\n"
+	"	vec2 cam;\n"
+	"	vec2 view;\n"
+	"	float cutoff;\n"
+	"};\n"
+	"void main()\n"
+	"{\n"
+	"	colour = texture(tex, Texcoord);\n"
+	"	if (colour.a <= cutoff)\n"
+	"		discard;\n"
+	"}\n";
+
+/* glyphs of a printed string laid out once and drawn by a single call */
+typedef struct {
+	int font, x, y, z;
+	char *s; /* text laid out so far; NULL if the run is free */
+	size_t len;
+	int penx, peny; /* where the next glyph goes relative to `x', `y' */
+	float *glyphs; /* copy of the buffer for when it has to grow */
+	size_t nglyphs, cap;
+	GLuint vao, vbo;
+	unsigned long frame; /* last frame the run was drawn in */
+} TextRun;
+
+/* static content of a layer drawn into a texture the size of the screen */
+typedef struct {
+	unsigned long key; /* 0 if the region is free */
+	int z, rx, ry; /* layer and position in screen sized steps */
+	int valid;
+	GLuint fbo, tex;
+	unsigned long frame; /* last frame the region was drawn in */
+} CachedRegion;
+
 struct gc {
 	float *vert;
 	GLuint vao, vbo, vertex_shader, fragment_shader, prog,
-	       texture, position, tfm, tex_scale, tex_offs, tex_z;
+	       texture, position, tex_place, tex_scale, tex_offs, tex_origin, tex_z, tex_cutoff;
 	char *v_shd_src, *f_shd_src;
-	GLuint sprites[SPRITE_LIMIT];
+	/* sprite sheets are packed into a few shared textures */
+	struct {
+		GLuint tex;
+		Atlas *atlas;
+		int w, h;
+	} pages[ATLAS_PAGES];
+	size_t npages;
+	GLuint sprites[SPRITE_LIMIT]; /* texture of the page holding the sheet */
+	char sprite_translucent[SPRITE_LIMIT]; /* has pixels neither clear nor opaque */
 	size_t nsprites, spritew[SPRITE_LIMIT], spriteh[SPRITE_LIMIT];
+	int sprite_origin[SPRITE_LIMIT][2]; /* sheet position in the page */
 	float sprite_scale[SPRITE_LIMIT][2];
+	float sprite_texel[SPRITE_LIMIT][2];
 	int w, h;
+	int refresh; /* of the monitor in Hz, 0 if unknown */
+	Camera cam;
 	GLFWwindow *window;
+	/* sprite batch; quads are queued while consecutive sprites share
+	 * a texture and drawn with a single call when it changes */
+	GLuint batch_vao, batch_vbo, batch_vertex_shader, batch_prog;
+	float *batch;
+	size_t nbatch;
+	GLuint batch_tex;
+	int batching;
+	float batch_texel[2];
+	/* instanced path used instead of expanding quads when GL 3.3 is there */
+	int instanced;
+	/* core profile; quads are indexed triangles and constants of the frame
+	 * sit in a uniform buffer */
+	int core;
+	GLuint quad_ebo, frame_ubo;
+	GLuint inst_quad, inst_vertex_shader, inst_prog;
+	/* program of the path in use and its uniforms */
+	GLuint sprite_prog, sprite_cam, sprite_view, sprite_texel_loc, sprite_cutoff;
+	size_t stride; /* floats per batched sprite */
+	RenderQueue *queue; /* sprites waiting to be sorted into the batch */
+	/* order by the depth buffer instead of drawing back to front */
+	int depth;
+	float cutoff;
+	TextRun runs[TEXT_RUNS];
+	CachedRegion regions[CACHE_REGIONS];
+	unsigned long frame;
+	/* shadow of the GL state; calls that would not change it are skipped */
+	struct {
+		GLuint prog, tex, vao;
+		int blend, depth_test, depth_mask;
+		GLenum depth_func;
+		struct {
+			GLuint prog;
+			GLint loc;
+			float v[4];
+		} uniforms[UNIFORM_SHADOWS];
+		size_t nuniforms;
+		float frame[8]; /* content of the uniform buffer */
+	} gl;
+	GcStats stats;
 };
 
+static int atlas_place(Gc *, size_t, size_t, int *, int *);
+static void instancing_init(Gc *);
+static void batch_attribs(Gc *, GLuint);
+static size_t sprite_emit(const Gc *, int, int, int, int, int, int, float, float *);
+static void batch_push(Gc *, int, int, int, int, int, int, float);
+static float layer_depth(int);
+static void batch_submit(Gc *, GLuint, const float *, size_t);
+static void batch_draw(Gc *);
+static TextRun *text_run(Gc *, int, int, int, int, const char *, size_t);
+static int text_run_extend(Gc *, TextRun *, const char *, size_t);
+static CachedRegion *cache_region(Gc *, unsigned long, int, int, int);
+static void cache_fill(Gc *, CachedRegion *, void (*)(Gc *, int, int, int, int, int, void *), void *);
+static int floordiv(int, int);
+static void state_program(Gc *, GLuint);
+static void state_texture(Gc *, GLuint);
+static void state_vao(Gc *, GLuint);
+static void state_enable(Gc *, GLenum, int);
+static void state_depth_mask(Gc *, int);
+static void state_depth_func(Gc *, GLenum);
+static void state_uniform(Gc *, GLint, int, const float *);
+static void state_uniform2f(Gc *, GLint, float, float);
+static void state_frame(Gc *);
+static GLuint shader_compile(GLenum, const char *);
+static void draw_quad(Gc *);
 static void key_callback(GLFWwindow *, int, int, int, int);
 
 static Input global_input;
@@ -88,24 +307,56 @@ static float vert[] = {
 	-1.0f,  1.0f,  0.0f,  0.0f
 };
 
+/* `vert' as triangles */
+static const GLubyte quad_index[] = { 0, 1, 2, 0, 2, 3 };
+/* GL types of `enum image_format' channels */
+static const GLenum pixel_type[] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_FLOAT };
+
 Gc *
 gc_new(void)
 {
 	return malloc(sizeof(Gc));
 }
 
+/**
+ * Open the window and set up drawing with the GL flavour of `profile'
+ * Falls back to the legacy profile if no core context can be made
+ */
 int
-gc_init(Gc *gc)
+gc_init(Gc *gc, enum gc_profile profile)
 {
-	char err[512];
+	size_t i;
+	GLuint progs[2];
+	GLuint block;
+	GLFWmonitor *monitor;
+	const GLFWvidmode *mode;
 
 	gc->nsprites = 0;
+	gc->npages = 0;
 	gc->w = 640;
 	gc->h = 480;
+	gc->nbatch = 0;
+	gc->batching = 0;
+	gc->frame = 0;
+	gc->depth = 0;
+	gc->cutoff = -1.f;
+	/* what a fresh context starts with */
+	memset(&gc->gl, 0, sizeof(gc->gl));
+	gc->gl.depth_mask = 1;
+	gc->gl.depth_func = GL_LESS;
+	memset(&gc->stats, 0, sizeof(gc->stats));
+	memset(gc->runs, 0, sizeof(gc->runs));
+	memset(gc->regions, 0, sizeof(gc->regions));
+	if (!(gc->queue = rqueue_create()))
+		return -1;
+	gc_set_camera(gc, NULL);
 
 	gc->vert = malloc(sizeof(vert));
 	if (gc->vert == NULL)
 		return -1;
+	gc->batch = malloc(sizeof(float) * BATCH_QUAD * BATCH_QUADS);
+	if (gc->batch == NULL)
+		return -1;
 	memcpy(gc->vert, vert, sizeof(vert));
 	gc->v_shd_src = strdup(vert_shader_src);
 	gc->f_shd_src = strdup(frag_shader_src);
@@ -114,8 +365,22 @@ gc_init(Gc *gc)
 		return -1;
 
 	LOG_INFO("opening %dx%d window", gc->w, gc->h);
+	gc->core = profile == GC_PROFILE_CORE;
 	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	if (gc->core) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+	}
 	gc->window = glfwCreateWindow(gc->w, gc->h, "Hello World", NULL, NULL);
+	if (!gc->window && gc->core) {
+		LOG_WARNING("no GL 3.3 core profile, falling back to legacy");
+		gc->core = 0;
+		glfwDefaultWindowHints();
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+		gc->window = glfwCreateWindow(gc->w, gc->h, "Hello World", NULL, NULL);
+	}
 
 	if (!gc->window) {
 		glfwTerminate();
@@ -124,6 +389,9 @@ gc_init(Gc *gc)
 
 	glfwMakeContextCurrent(gc->window);
 	glfwSwapInterval(1);
+	monitor = glfwGetPrimaryMonitor();
+	mode = monitor ? glfwGetVideoMode(monitor) : NULL;
+	gc->refresh = mode ? mode->refreshRate : 0;
 	glViewport(0, 0, gc->w, gc->h);
 
 	glewExperimental = GL_TRUE;
@@ -133,156 +401,520 @@ gc_init(Gc *gc)
 	}
 
 	glGenVertexArrays(1, &gc->vao);
-	glBindVertexArray(gc->vao);
+	state_vao(gc, gc->vao);
 	glGenBuffers(1, &gc->vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, gc->vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(vert), gc->vert, GL_STATIC_DRAW);
+	if (gc->core) {
+		/* there are no quads in the core profile */
+		glGenBuffers(1, &gc->quad_ebo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gc->quad_ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(quad_index), quad_index, GL_STATIC_DRAW);
+	}
 
 	/* transparency */
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	state_enable(gc, GL_BLEND, 1);
+	/* alpha is accumulated too so that cached layers keep their holes */
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
 	glClearColor(1.f, 1.f, 1.f, 1.f);
-	//glEnable(GL_DEPTH_TEST);
-
-	gc->vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(gc->vertex_shader, 1, &vert_shader_src, NULL);
-	glCompileShader(gc->vertex_shader);
-	glGetShaderInfoLog(gc->vertex_shader, 512, NULL, err);
-	LOG_ERROR("%s", err);
+	/* sprites drawn later win ties in the depth mode */
+	state_depth_func(gc, GL_LEQUAL);
 
-	gc->fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(gc->fragment_shader, 1, &frag_shader_src, NULL);
-	glCompileShader(gc->fragment_shader);
-	glGetShaderInfoLog(gc->fragment_shader, 512, NULL, err);
-	LOG_ERROR("%s", err);
+	gc->vertex_shader = shader_compile(GL_VERTEX_SHADER,
+		gc->core ? core_vert_shader_src : vert_shader_src);
+	gc->fragment_shader = shader_compile(GL_FRAGMENT_SHADER,
+		gc->core ? core_frag_shader_src : frag_shader_src);
 
 	gc->prog = glCreateProgram();
 	glAttachShader(gc->prog, gc->vertex_shader);
 	glAttachShader(gc->prog, gc->fragment_shader);
 	glLinkProgram(gc->prog);
-	glUseProgram(gc->prog);
+	state_program(gc, gc->prog);
 
 	gc->position = glGetAttribLocation(gc->prog, "position");
-	gc->texture = glGetAttribLocation(gc->prog, "texture");
+	gc->texture = glGetAttribLocation(gc->prog, "uv");
 	glVertexAttribPointer(gc->position, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
 	glVertexAttribPointer(gc->texture, 2, GL_FLOAT, GL_FALSE, 4*sizeof(float), (void *)(2*sizeof(float)));
 	glEnableVertexAttribArray(gc->position);
 	glEnableVertexAttribArray(gc->texture);
 
-	gc->tfm = glGetUniformLocation(gc->prog, "tfm");
+	gc->tex_place = glGetUniformLocation(gc->prog, "place");
 	gc->tex_scale = glGetUniformLocation(gc->prog, "scale");
 	gc->tex_offs = glGetUniformLocation(gc->prog, "offs");
+	gc->tex_origin = glGetUniformLocation(gc->prog, "origin");
 	gc->tex_z = glGetUniformLocation(gc->prog, "zpos");
+	gc->tex_cutoff = glGetUniformLocation(gc->prog, "cutoff");
+
+	gc->instanced = gc->core || GLEW_VERSION_3_3;
+	gc->stride = BATCH_QUAD;
+	if (!gc->core) {
+		gc->batch_vertex_shader = shader_compile(GL_VERTEX_SHADER, batch_vert_shader_src);
+		gc->batch_prog = glCreateProgram();
+		glAttachShader(gc->batch_prog, gc->batch_vertex_shader);
+		glAttachShader(gc->batch_prog, gc->fragment_shader);
+		glLinkProgram(gc->batch_prog);
+		gc->sprite_prog = gc->batch_prog;
+	}
+	if (gc->instanced)
+		instancing_init(gc);
+	if (gc->core) {
+		glGenBuffers(1, &gc->frame_ubo);
+		glBindBuffer(GL_UNIFORM_BUFFER, gc->frame_ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(gc->gl.frame), gc->gl.frame, GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, gc->frame_ubo);
+		progs[0] = gc->prog;
+		progs[1] = gc->inst_prog;
+		for (i = 0; i < 2; ++i)
+			if ((block = glGetUniformBlockIndex(progs[i], "Frame")) != GL_INVALID_INDEX)
+				glUniformBlockBinding(progs[i], block, 0);
+	}
+	gc->sprite_cam = glGetUniformLocation(gc->sprite_prog, "cam");
+	gc->sprite_view = glGetUniformLocation(gc->sprite_prog, "view");
+	gc->sprite_texel_loc = glGetUniformLocation(gc->sprite_prog, "texel");
+	gc->sprite_cutoff = glGetUniformLocation(gc->sprite_prog, "cutoff");
+
+	/* batched sprites are streamed anew on every draw */
+	glGenVertexArrays(1, &gc->batch_vao);
+	state_vao(gc, gc->batch_vao);
+	glGenBuffers(1, &gc->batch_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, gc->batch_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * gc->stride * BATCH_QUADS, NULL, GL_STREAM_DRAW);
+	batch_attribs(gc, gc->batch_vbo);
+	LOG_INFO("%s profile, batching sprites %s", gc->core ? "core" : "legacy",
+		gc->instanced ? "by instancing" : "into quads");
+	state_vao(gc, gc->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gc->vbo);
 
 	return 0;
 }
 
+/**
+ * Load a sheet of `w' by `h' frames
+ * The sheet is packed into one of the atlas pages; frames are picked by
+ * `ox', `oy' passed to the drawing functions
+ */
 int
 gc_create_sprite(Gc *gc, const Image *img, unsigned int w, unsigned int h)
 {
-	GLuint tex;
+	int page, x, y;
 
-	if (gc->nsprites > SPRITE_LIMIT)
+	if (gc->nsprites >= SPRITE_LIMIT)
 		return -1;
 
 	LOG_DEBUG("loading a sprite of size %dx%d", img->w, img->h);
-	glUseProgram(gc->prog);
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->w, img->h, 0, GL_RGBA, GL_FLOAT, img->d);
+	if ((page = atlas_place(gc, img->w, img->h, &x, &y)) < 0) {
+		LOG_ERROR("no room for a %zux%zu sprite sheet", img->w, img->h);
+		return -1;
+	}
+	state_texture(gc, gc->pages[page].tex);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, img->w, img->h, GL_RGBA, pixel_type[img->fmt], img->d);
 
-	gc->sprites[gc->nsprites] = tex;
+	gc->sprites[gc->nsprites] = gc->pages[page].tex;
+	/* such sheets cannot be depth tested without blending errors */
+	gc->sprite_translucent[gc->nsprites] = image_translucent(img);
 	gc->spritew[gc->nsprites] = w;
 	gc->spriteh[gc->nsprites] = h;
-	gc->sprite_scale[gc->nsprites][0] = (float)w/(float)img->w;
-	gc->sprite_scale[gc->nsprites][1] = (float)h/(float)img->h;
+	gc->sprite_origin[gc->nsprites][0] = x;
+	gc->sprite_origin[gc->nsprites][1] = y;
+	gc->sprite_scale[gc->nsprites][0] = (float)w/(float)gc->pages[page].w;
+	gc->sprite_scale[gc->nsprites][1] = (float)h/(float)gc->pages[page].h;
+	gc->sprite_texel[gc->nsprites][0] = 1.f/(float)gc->pages[page].w;
+	gc->sprite_texel[gc->nsprites][1] = 1.f/(float)gc->pages[page].h;
 	return gc->nsprites++;
 }
 
 void
 gc_draw(Gc *gc, int sprite, int x, int y, int z, int ox, int oy)
 {
-	float tfm[] = {
-		 1.0f,  0.0f,  0.0f,  0.0f,
-		 0.0f,  1.0f,  0.0f,  0.0f,
-		 0.0f,  0.0f,  1.0f,  0.0f,
-		 0.0f,  0.0f,  0.0f,  1.0f
-	};
+	float place[4], depth;
+
 	/* translate */
-	tfm[3] = -1.f + (double)x/(double)gc->w;
-	tfm[7] = 1.f - (double)y/(double)gc->h;
+	place[0] = -1.f + (double)(x - gc->cam.x) * gc->cam.zoom/(double)gc->w;
+	place[1] = 1.f - (double)(y - gc->cam.y) * gc->cam.zoom/(double)gc->h;
 	/* scale */
-	tfm[0] = (double)gc->spritew[sprite]/(double)gc->w;
-	tfm[5] = (double)gc->spriteh[sprite]/(double)gc->h;
-	glUseProgram(gc->prog);
-	glBindTexture(GL_TEXTURE_2D, gc->sprites[sprite]);
-	glUniformMatrix4fv(gc->tfm, 1, GL_FALSE, tfm);
-	glUniform2fv(gc->tex_scale, 1, gc->sprite_scale[sprite]);
-	glUniform2f(gc->tex_offs, (float)ox, (float)oy);
-	glUniform1f(gc->tex_z, (float)z);
-	glDrawArrays(GL_QUADS, 0, 4);
+	place[2] = (double)gc->spritew[sprite] * gc->cam.zoom/(double)gc->w;
+	place[3] = (double)gc->spriteh[sprite] * gc->cam.zoom/(double)gc->h;
+	depth = layer_depth(z);
+	/* keep the order of sprites queued earlier */
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	state_vao(gc, gc->vao);
+	state_program(gc, gc->prog);
+	state_texture(gc, gc->sprites[sprite]);
+	state_uniform(gc, gc->tex_place, 4, place);
+	state_uniform(gc, gc->tex_scale, 2, gc->sprite_scale[sprite]);
+	state_uniform2f(gc, gc->tex_origin, gc->sprite_origin[sprite][0] * gc->sprite_texel[sprite][0],
+		gc->sprite_origin[sprite][1] * gc->sprite_texel[sprite][1]);
+	state_uniform2f(gc, gc->tex_offs, (float)ox, (float)oy);
+	state_uniform(gc, gc->tex_z, 1, &depth);
+	state_uniform(gc, gc->tex_cutoff, 1, &gc->cutoff);
+	state_frame(gc);
+	draw_quad(gc);
 }
 
+/**
+ * Print `len' characters of `s', or all of it if `len' is 0
+ * Glyphs are laid out once and kept across frames; printing a longer
+ * version of the same text at the same place only lays out the new ones
+ */
 void
 gc_print(Gc *gc, int sprite, int x, int y, int z, const char *s, size_t len)
 {
-	size_t i;
-	int ox, oy, c;
-	float tfm[] = {
-		 1.0f,  0.0f,  0.0f,  0.0f,
-		 0.0f,  1.0f,  0.0f,  0.0f,
-		 0.0f,  0.0f,  1.0f,  0.0f,
-		 0.0f,  0.0f,  0.0f,  1.0f
-	};
+	TextRun *run;
 
 	if (!len)
 		len = strlen(s);
-	/* translate */
-	tfm[3] = -1.f + (float)x/(float)gc->w;
-	tfm[7] = 1.f - (float)y/(float)gc->h;
-	/* scale */
-	tfm[0] = (float)gc->spritew[sprite]/(float)gc->w;
-	tfm[5] = (float)gc->spriteh[sprite]/(float)gc->h;
-	glUseProgram(gc->prog);
-	glBindTexture(GL_TEXTURE_2D, gc->sprites[sprite]);
-	glUniform2fv(gc->tex_scale, 1, gc->sprite_scale[sprite]);
-	for (i = 0; i < len; ++i) {
-		if (s[i] == '\n') {
-			tfm[3] = -1.f + (float)x/(float)gc->w;
-			tfm[7] -= 2.f * (float)gc->spriteh[sprite] / (float)gc->h;
-			continue;
+	if (!len)
+		return;
+	/* keep the order of sprites queued earlier */
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	if (!(run = text_run(gc, sprite, x, y, z, s, len)))
+		return;
+	run->frame = gc->frame;
+	state_vao(gc, run->vao);
+	batch_submit(gc, gc->sprites[sprite], gc->sprite_texel[sprite], run->nglyphs);
+}
+
+/**
+ * Start queueing sprites instead of drawing them one by one
+ */
+void
+gc_batch_begin(Gc *gc)
+{
+	gc->batching = 1;
+}
+
+/**
+ * Queue a sprite; takes the same arguments as `gc_draw'
+ */
+void
+gc_batch_push(Gc *gc, int sprite, int x, int y, int z, int ox, int oy)
+{
+	batch_push(gc, sprite, x, y, z, ox, oy, FLAT);
+}
+
+/**
+ * Draw all the queued sprites and stop batching
+ */
+void
+gc_batch_flush(Gc *gc)
+{
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	gc->batching = 0;
+}
+
+/**
+ * Queue a sprite to be drawn later, ordered by `z' first and by its lower
+ * edge next, so that what stands closer to the viewer covers the rest
+ * Takes the same arguments as `gc_draw'; negative `z' counts as 0
+ */
+void
+gc_queue_push(Gc *gc, int sprite, int x, int y, int z, int ox, int oy)
+{
+	RenderCmd cmd;
+
+	cmd.sprite = sprite;
+	cmd.x = x;
+	cmd.y = y;
+	cmd.z = z;
+	cmd.ox = ox;
+	cmd.oy = oy;
+	/* ties are broken by sheet rather than by atlas page, as the software
+	 * renderer has no pages and must order them alike */
+	rqueue_push(gc->queue, rqueue_key(z < 0 ? 0 : z, y + (int)gc->spriteh[sprite], sprite), &cmd);
+}
+
+/**
+ * Sort the queued sprites and hand them over to the batch
+ */
+void
+gc_queue_submit(Gc *gc)
+{
+	size_t i, n;
+	const RenderCmd *cmd;
+
+	n = rqueue_sort(gc->queue);
+	if (!gc->depth) {
+		for (i = 0; i < n; ++i) {
+			cmd = rqueue_get(gc->queue, i);
+			batch_push(gc, cmd->sprite, cmd->x, cmd->y, cmd->z, cmd->ox, cmd->oy,
+				cmd->y + gc->spriteh[cmd->sprite]);
 		}
-		c = s[i] - 32;
-		oy = c / 10;
-		ox = c % 10;
-		glUniform2f(gc->tex_offs, (float)ox, (float)oy);
-		glUniformMatrix4fv(gc->tfm, 1, GL_FALSE, tfm);
-		glDrawArrays(GL_QUADS, 0, 4);
-		/* move one width to the right */
-		//x += gc->spritew[sprite] * 2;
-		//tfm[3] = -1.f + (float)x/(float)gc->w;
-		tfm[3] += 2.f * (float)gc->spritew[sprite] / (float)gc->w;
+		rqueue_clear(gc->queue);
+		return;
+	}
+	/* opaque sprites front to back so that covered pixels are rejected
+	 * before shading, then translucent ones blended back to front; going
+	 * front to back, the first sprite drawn has to win ties to keep the
+	 * order of the other modes */
+	batch_draw(gc);
+	state_depth_func(gc, GL_LESS);
+	for (i = n; i--;) {
+		cmd = rqueue_get(gc->queue, i);
+		if (!gc->sprite_translucent[cmd->sprite])
+			batch_push(gc, cmd->sprite, cmd->x, cmd->y, cmd->z, cmd->ox, cmd->oy,
+				cmd->y + gc->spriteh[cmd->sprite]);
+	}
+	batch_draw(gc);
+	state_depth_func(gc, GL_LEQUAL);
+	state_depth_mask(gc, 0);
+	for (i = 0; i < n; ++i) {
+		cmd = rqueue_get(gc->queue, i);
+		if (gc->sprite_translucent[cmd->sprite])
+			batch_push(gc, cmd->sprite, cmd->x, cmd->y, cmd->z, cmd->ox, cmd->oy,
+				cmd->y + gc->spriteh[cmd->sprite]);
+	}
+	batch_draw(gc);
+	state_depth_mask(gc, 1);
+	rqueue_clear(gc->queue);
+}
+
+/**
+ * Let the depth buffer order sprites instead of drawing them back to front
+ * Pixels more transparent than ALPHA_CUTOFF are dropped in this mode;
+ * sheets with partial transparency are still blended in order
+ */
+void
+gc_set_depth_test(Gc *gc, int on)
+{
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	gc->depth = on;
+	gc->cutoff = on ? ALPHA_CUTOFF : -1.f;
+	state_enable(gc, GL_DEPTH_TEST, on);
+}
+
+/**
+ * Draw static content of layer `z' from screen sized textures, calling
+ * `fn' only to draw regions that are not cached yet
+ * `fn' gets the layer and the area to draw in drawing coordinates and
+ * should push its sprites to the batch; `key' tells apart owners of
+ * cached layers and must not be 0
+ */
+void
+gc_draw_cached(Gc *gc, unsigned long key, int z,
+	void (*fn)(Gc *, int, int, int, int, int, void *), void *ctx)
+{
+	int x0, y0, x1, y1, rx, ry;
+	CachedRegion *r;
+	float place[4], depth;
+
+	/* keep the order of sprites queued earlier */
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	gc_get_view(gc, &x0, &y0, &x1, &y1);
+	for (ry = floordiv(y0, 2 * gc->h); ry <= floordiv(y1 - 1, 2 * gc->h); ++ry) {
+		for (rx = floordiv(x0, 2 * gc->w); rx <= floordiv(x1 - 1, 2 * gc->w); ++rx) {
+			if (!(r = cache_region(gc, key, z, rx, ry))) {
+				fn(gc, z, rx * 2 * gc->w, ry * 2 * gc->h,
+					(rx + 1) * 2 * gc->w, (ry + 1) * 2 * gc->h, ctx);
+				batch_draw(gc);
+				continue;
+			}
+			if (!r->valid)
+				cache_fill(gc, r, fn, ctx);
+			r->frame = gc->frame;
+			/* a single quad over the region; drawing coordinates
+			 * span twice the pixels, so this is the zoom itself */
+			place[0] = -1.f + (double)((2 * rx + 1) * gc->w - gc->cam.x) * gc->cam.zoom/(double)gc->w;
+			place[1] = 1.f - (double)((2 * ry + 1) * gc->h - gc->cam.y) * gc->cam.zoom/(double)gc->h;
+			place[2] = place[3] = gc->cam.zoom;
+			depth = layer_depth(z);
+			state_vao(gc, gc->vao);
+			state_program(gc, gc->prog);
+			state_texture(gc, r->tex);
+			state_uniform(gc, gc->tex_place, 4, place);
+			/* rows of framebuffer textures go bottom up */
+			state_uniform2f(gc, gc->tex_scale, 1.f, -1.f);
+			state_uniform2f(gc, gc->tex_origin, 0.f, 1.f);
+			state_uniform2f(gc, gc->tex_offs, 0.f, 0.f);
+			state_uniform(gc, gc->tex_z, 1, &depth);
+			state_uniform(gc, gc->tex_cutoff, 1, &gc->cutoff);
+			state_frame(gc);
+			draw_quad(gc);
+		}
+	}
+}
+
+/**
+ * Redraw cached regions of layer `z' overlapping the given area the next
+ * time they are drawn
+ */
+void
+gc_invalidate_cache(Gc *gc, unsigned long key, int z, int x0, int y0, int x1, int y1)
+{
+	size_t i;
+	CachedRegion *r;
+
+	for (i = 0; i < CACHE_REGIONS; ++i) {
+		r = &gc->regions[i];
+		if (r->key == key && r->z == z
+		    && r->rx * 2 * gc->w < x1 && (r->rx + 1) * 2 * gc->w > x0
+		    && r->ry * 2 * gc->h < y1 && (r->ry + 1) * 2 * gc->h > y0)
+			r->valid = 0;
 	}
 }
 
+/**
+ * Get how many GL state changes were issued and how many were skipped
+ * for not changing anything
+ */
+void
+gc_get_stats(const Gc *gc, GcStats *stats)
+{
+	*stats = gc->stats;
+}
+
+/**
+ * Check whether a sprite drawn at `x', `y' would end up on the screen
+ */
+int
+gc_visible(const Gc *gc, int sprite, int x, int y)
+{
+	int x0, y0, x1, y1;
+
+	gc_get_view(gc, &x0, &y0, &x1, &y1);
+	/* sprites are drawn centered and twice the size in drawing coordinates */
+	return x + (int)gc->spritew[sprite] > x0 && x - (int)gc->spritew[sprite] < x1
+		&& y + (int)gc->spriteh[sprite] > y0 && y - (int)gc->spriteh[sprite] < y1;
+}
+
+/**
+ * Get the refresh rate of the display in Hz, 0 if unknown
+ */
+int
+gc_refresh_rate(const Gc *gc)
+{
+	return gc->refresh;
+}
+
+/**
+ * Get size of the screen in pixels
+ */
+void
+gc_get_size(const Gc *gc, int *w, int *h)
+{
+	*w = gc->w;
+	*h = gc->h;
+}
+
+/**
+ * Get half of the extent a sprite covers in drawing coordinates
+ */
+void
+gc_sprite_size(const Gc *gc, int sprite, int *w, int *h)
+{
+	*w = gc->spritew[sprite];
+	*h = gc->spriteh[sprite];
+}
+
+/**
+ * Move the view; NULL resets it to plain screen coordinates
+ */
+void
+gc_set_camera(Gc *gc, const Camera *cam)
+{
+	/* queued sprites were placed with the old view */
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	if (!cam) {
+		gc->cam.x = gc->cam.y = 0;
+		gc->cam.zoom = 1.f;
+		return;
+	}
+	gc->cam = *cam;
+	if (gc->cam.zoom <= 0.f)
+		gc->cam.zoom = 1.f;
+}
+
+/**
+ * Get the area visible through the camera in drawing coordinates
+ */
+void
+gc_get_view(const Gc *gc, int *x0, int *y0, int *x1, int *y1)
+{
+	/* drawing coordinates span twice the window size */
+	*x0 = gc->cam.x;
+	*y0 = gc->cam.y;
+	*x1 = gc->cam.x + (int)(2 * gc->w / gc->cam.zoom);
+	*y1 = gc->cam.y + (int)(2 * gc->h / gc->cam.zoom);
+}
+
 void
 gc_clear(Gc *gc)
 {
-	glClear(GL_COLOR_BUFFER_BIT);
+	glClear(gc->depth ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT);
 }
 
 void
 gc_commit(Gc *gc)
 {
+	size_t i;
+
+	/* text not printed during the frame is not coming back */
+	for (i = 0; i < TEXT_RUNS; ++i) {
+		if (gc->runs[i].s && gc->runs[i].frame != gc->frame) {
+			free(gc->runs[i].s);
+			gc->runs[i].s = NULL;
+		}
+	}
+	++gc->frame;
 	glfwSwapBuffers(gc->window);
+}
+
+/**
+ * Process window events; only ever on the main thread
+ */
+void
+gc_poll_events(const Gc *gc)
+{
 	glfwPollEvents();
 }
 
+/**
+ * Write the frame drawn so far as a farbfeld image
+ */
+int
+gc_dump(const Gc *gc, const char *path)
+{
+	FILE *f;
+	uint8_t hdr[16], px[8], *d;
+	size_t i, row;
+	int j, y;
+
+	if (!(d = malloc((size_t)gc->w * gc->h * 4)))
+		return -1;
+	glReadPixels(0, 0, gc->w, gc->h, GL_RGBA, GL_UNSIGNED_BYTE, d);
+	if (!(f = fopen(path, "wb"))) {
+		LOG_ERROR("cannot open %s for writing", path);
+		free(d);
+		return -1;
+	}
+	memcpy(hdr, "farbfeld", 8);
+	for (j = 0; j < 4; ++j) {
+		hdr[8 + j] = (uint32_t)gc->w >> (24 - 8 * j);
+		hdr[12 + j] = (uint32_t)gc->h >> (24 - 8 * j);
+	}
+	fwrite(hdr, 1, sizeof(hdr), f);
+	/* GL rows go bottom up; farbfeld has 16 bits per channel, big endian */
+	for (y = gc->h; y--;) {
+		row = (size_t)y * gc->w * 4;
+		for (i = 0; i < (size_t)gc->w; ++i) {
+			for (j = 0; j < 4; ++j)
+				px[2 * j] = px[2 * j + 1] = d[row + 4 * i + j];
+			fwrite(px, 1, sizeof(px), f);
+		}
+	}
+	free(d);
+	if (fclose(f)) {
+		LOG_ERROR("failed writing %s", path);
+		return -1;
+	}
+	return 0;
+}
+
 GLFWwindow *
 gc_get_window(const Gc *gc)
 {
@@ -295,29 +927,29 @@ gc_alive(const Gc *gc)
 	return !glfwWindowShouldClose(gc->window);
 }
 
+/**
+ * Make the context current on the calling thread
+ */
 void
 gc_select(const Gc *gc)
 {
 	glfwMakeContextCurrent(gc->window);
 }
 
+/**
+ * Detach the context from the calling thread so another may select it
+ */
 void
-gc_set_resolution(const Gc *gc, unsigned int width, unsigned int height)
+gc_release(const Gc *gc)
 {
-	glfwSetWindowSize(gc->window, width, height);
-	glViewport(0, 0, width, height);
+	glfwMakeContextCurrent(NULL);
 }
 
-int
-gc_check_timer(double delta)
+void
+gc_set_resolution(const Gc *gc, unsigned int width, unsigned int height)
 {
-	double now;
-
-	now = glfwGetTime();
-	if (now < delta)
-		return 0;
-	glfwSetTime(now - delta);
-	return 1;
+	glfwSetWindowSize(gc->window, width, height);
+	glViewport(0, 0, width, height);
 }
 
 void
@@ -333,6 +965,614 @@ gc_poll_input(void)
 	return global_input;
 }
 
+/**
+ * Find room for a `w' by `h' sheet in the atlas, opening a new page if
+ * none of the current ones has enough
+ * Returns index of the page or -1
+ */
+static int
+atlas_place(Gc *gc, size_t w, size_t h, int *x, int *y)
+{
+	size_t i;
+	int pw, ph;
+	void *blank;
+
+	for (i = 0; i < gc->npages; ++i)
+		if (atlas_pack(gc->pages[i].atlas, w + ATLAS_PADDING, h + ATLAS_PADDING, x, y))
+			return i;
+	if (gc->npages == ATLAS_PAGES)
+		return -1;
+	pw = w + ATLAS_PADDING > ATLAS_SIZE ? w + ATLAS_PADDING : ATLAS_SIZE;
+	ph = h + ATLAS_PADDING > ATLAS_SIZE ? h + ATLAS_PADDING : ATLAS_SIZE;
+	if (!(gc->pages[i].atlas = atlas_create(pw, ph)))
+		return -1;
+	gc->pages[i].w = pw;
+	gc->pages[i].h = ph;
+	glGenTextures(1, &gc->pages[i].tex);
+	state_texture(gc, gc->pages[i].tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	/* padding between sheets is left transparent */
+	blank = calloc((size_t)pw * ph, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pw, ph, 0, GL_RGBA, GL_UNSIGNED_BYTE, blank);
+	free(blank);
+	LOG_DEBUG("opened %dx%d atlas page #%zu", pw, ph, i);
+	++gc->npages;
+	atlas_pack(gc->pages[i].atlas, w + ATLAS_PADDING, h + ATLAS_PADDING, x, y);
+
+	return i;
+}
+
+/**
+ * Set up drawing of batches as instances of a single quad
+ */
+static void
+instancing_init(Gc *gc)
+{
+	/* unit quad as two triangles: x, y, u, v */
+	static const float quad[] = {
+		 1.f,  1.f, 1.f, 0.f,
+		 1.f, -1.f, 1.f, 1.f,
+		-1.f, -1.f, 0.f, 1.f,
+		 1.f,  1.f, 1.f, 0.f,
+		-1.f, -1.f, 0.f, 1.f,
+		-1.f,  1.f, 0.f, 0.f
+	};
+
+	gc->inst_vertex_shader = shader_compile(GL_VERTEX_SHADER,
+		gc->core ? core_inst_vert_shader_src : inst_vert_shader_src);
+
+	gc->inst_prog = glCreateProgram();
+	glAttachShader(gc->inst_prog, gc->inst_vertex_shader);
+	glAttachShader(gc->inst_prog, gc->fragment_shader);
+	glLinkProgram(gc->inst_prog);
+
+	glGenBuffers(1, &gc->inst_quad);
+	glBindBuffer(GL_ARRAY_BUFFER, gc->inst_quad);
+	/* the core profile indexes corners of `vert' instead */
+	if (gc->core)
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vert), vert, GL_STATIC_DRAW);
+	else
+		glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	gc->sprite_prog = gc->inst_prog;
+	gc->stride = BATCH_INSTANCE;
+}
+
+/**
+ * Point the attributes of the bound vertex array at sprites stored in `vbo'
+ */
+static void
+batch_attribs(Gc *gc, GLuint vbo)
+{
+	GLint attr;
+	size_t i;
+	static const struct {
+		const char *name;
+		int size, offs;
+	} attrs[] = {
+		{ "pos", 2, 0 },
+		{ "frame", 2, 2 },
+		{ "origin", 2, 4 },
+		{ "zpos", 1, 6 },
+		{ "base", 1, 7 }
+	};
+
+	if (!gc->instanced) {
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		attr = glGetAttribLocation(gc->batch_prog, "position");
+		glVertexAttribPointer(attr, 3, GL_FLOAT, GL_FALSE, BATCH_VERTEX*sizeof(float), 0);
+		glEnableVertexAttribArray(attr);
+		attr = glGetAttribLocation(gc->batch_prog, "base");
+		glVertexAttribPointer(attr, 1, GL_FLOAT, GL_FALSE, BATCH_VERTEX*sizeof(float), (void *)(3*sizeof(float)));
+		glEnableVertexAttribArray(attr);
+		attr = glGetAttribLocation(gc->batch_prog, "uv");
+		glVertexAttribPointer(attr, 2, GL_FLOAT, GL_FALSE, BATCH_VERTEX*sizeof(float), (void *)(4*sizeof(float)));
+		glEnableVertexAttribArray(attr);
+		return;
+	}
+	if (gc->core)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gc->quad_ebo);
+	glBindBuffer(GL_ARRAY_BUFFER, gc->inst_quad);
+	attr = glGetAttribLocation(gc->inst_prog, "corner");
+	glVertexAttribPointer(attr, 4, GL_FLOAT, GL_FALSE, 4*sizeof(float), 0);
+	glEnableVertexAttribArray(attr);
+	/* per instance attributes advance once per quad */
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	for (i = 0; i < sizeof(attrs) / sizeof(attrs[0]); ++i) {
+		attr = glGetAttribLocation(gc->inst_prog, attrs[i].name);
+		glVertexAttribPointer(attr, attrs[i].size, GL_FLOAT, GL_FALSE,
+			BATCH_INSTANCE*sizeof(float), (void *)(attrs[i].offs*sizeof(float)));
+		glVertexAttribDivisor(attr, 1);
+		glEnableVertexAttribArray(attr);
+	}
+}
+
+/**
+ * Write a sprite the way the batch program expects it to `v'; `base' is
+ * the height its depth is taken from
+ * Returns the amount of floats written
+ */
+static size_t
+sprite_emit(const Gc *gc, int sprite, int x, int y, int z, int ox, int oy, float base, float *v)
+{
+	int i;
+	/* corners of the sprite quad as two triangles: x, y, u, v */
+	static const float quad[6][4] = {
+		{  1.f,  1.f, 1.f, 0.f },
+		{  1.f, -1.f, 1.f, 1.f },
+		{ -1.f, -1.f, 0.f, 1.f },
+		{  1.f,  1.f, 1.f, 0.f },
+		{ -1.f, -1.f, 0.f, 1.f },
+		{ -1.f,  1.f, 0.f, 0.f }
+	};
+
+	if (gc->instanced) {
+		v[0] = x;
+		v[1] = y;
+		v[2] = gc->spritew[sprite];
+		v[3] = gc->spriteh[sprite];
+		v[4] = gc->sprite_origin[sprite][0] + ox * gc->spritew[sprite];
+		v[5] = gc->sprite_origin[sprite][1] + oy * gc->spriteh[sprite];
+		v[6] = z;
+		v[7] = base;
+		return BATCH_INSTANCE;
+	}
+	for (i = 0; i < 6; ++i, v += BATCH_VERTEX) {
+		v[0] = x + quad[i][0] * gc->spritew[sprite];
+		v[1] = y - quad[i][1] * gc->spriteh[sprite];
+		v[2] = z;
+		v[3] = base;
+		v[4] = gc->sprite_origin[sprite][0] * gc->sprite_texel[sprite][0]
+			+ (quad[i][2] + ox) * gc->sprite_scale[sprite][0];
+		v[5] = gc->sprite_origin[sprite][1] * gc->sprite_texel[sprite][1]
+			+ (quad[i][3] + oy) * gc->sprite_scale[sprite][1];
+	}
+	return BATCH_QUAD;
+}
+
+static void
+batch_push(Gc *gc, int sprite, int x, int y, int z, int ox, int oy, float base)
+{
+	if (!gc->batching) {
+		gc_draw(gc, sprite, x, y, z, ox, oy);
+		return;
+	}
+	if (gc->nbatch && (gc->batch_tex != gc->sprites[sprite] || gc->nbatch == BATCH_QUADS))
+		batch_draw(gc);
+	gc->batch_tex = gc->sprites[sprite];
+	gc->batch_texel[0] = gc->sprite_texel[sprite][0];
+	gc->batch_texel[1] = gc->sprite_texel[sprite][1];
+	sprite_emit(gc, sprite, x, y, z, ox, oy, base, gc->batch + gc->nbatch++ * gc->stride);
+}
+
+/**
+ * Get depth of sprites lying flat in layer `z' as the shaders compute it
+ */
+static float
+layer_depth(int z)
+{
+	z = z < 0 ? 0 : z >= DEPTH_LAYERS ? DEPTH_LAYERS - 1 : z;
+	return 1.f - (float)z / (DEPTH_LAYERS / 2);
+}
+
+/**
+ * Draw `n' sprites of the bound vertex array with the current view
+ */
+static void
+batch_submit(Gc *gc, GLuint tex, const float *texel, size_t n)
+{
+	state_program(gc, gc->sprite_prog);
+	state_uniform2f(gc, gc->sprite_cam, (float)gc->cam.x, (float)gc->cam.y);
+	state_uniform2f(gc, gc->sprite_view, gc->cam.zoom/(float)gc->w, gc->cam.zoom/(float)gc->h);
+	state_uniform(gc, gc->sprite_cutoff, 1, &gc->cutoff);
+	state_frame(gc);
+	state_texture(gc, tex);
+	if (gc->instanced) {
+		state_uniform(gc, gc->sprite_texel_loc, 2, texel);
+		if (gc->core)
+			glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0, n);
+		else
+			glDrawArraysInstanced(GL_TRIANGLES, 0, 6, n);
+		return;
+	}
+	glDrawArrays(GL_TRIANGLES, 0, 6 * n);
+}
+
+static void
+batch_draw(Gc *gc)
+{
+	if (!gc->nbatch)
+		return;
+	state_vao(gc, gc->batch_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, gc->batch_vbo);
+	/* orphan the buffer so that the driver does not wait for the last draw */
+	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * gc->stride * BATCH_QUADS, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * gc->stride * gc->nbatch, gc->batch);
+	batch_submit(gc, gc->batch_tex, gc->batch_texel, gc->nbatch);
+	gc->nbatch = 0;
+}
+
+/**
+ * Get the run holding `s' printed at `x', `y', `z', laying out whatever
+ * glyphs are not there yet
+ * A run printed earlier is reused if its text is the beginning of `s';
+ * otherwise a free or the least recently drawn one is taken over
+ */
+static TextRun *
+text_run(Gc *gc, int font, int x, int y, int z, const char *s, size_t len)
+{
+	TextRun *run, *victim;
+	size_t i;
+
+	victim = NULL;
+	for (i = 0; i < TEXT_RUNS; ++i) {
+		run = &gc->runs[i];
+		if (!run->s) {
+			if (!victim || victim->s)
+				victim = run;
+			continue;
+		}
+		if (run->font == font && run->x == x && run->y == y && run->z == z
+		    && run->len <= len && !memcmp(run->s, s, run->len))
+			return text_run_extend(gc, run, s, len) ? run : NULL;
+		if (!victim || (victim->s && run->frame < victim->frame))
+			victim = run;
+	}
+	run = victim;
+	free(run->s);
+	if (!(run->s = malloc(len)))
+		return NULL;
+	if (!run->vao) {
+		glGenVertexArrays(1, &run->vao);
+		glGenBuffers(1, &run->vbo);
+		state_vao(gc, run->vao);
+		batch_attribs(gc, run->vbo);
+	}
+	run->font = font;
+	run->x = x;
+	run->y = y;
+	run->z = z;
+	run->len = 0;
+	run->penx = run->peny = 0;
+	run->nglyphs = 0;
+	return text_run_extend(gc, run, s, len) ? run : NULL;
+}
+
+/**
+ * Lay out the characters of `s' past the ones already in the run and
+ * upload only those
+ */
+static int
+text_run_extend(Gc *gc, TextRun *run, const char *s, size_t len)
+{
+	size_t i, from, cap;
+	int c, grown;
+	float *glyphs;
+	char *t;
+
+	if (run->len == len)
+		return 1;
+	grown = 0;
+	if (run->nglyphs + len - run->len > run->cap) {
+		cap = run->cap ? run->cap * 2 : 16;
+		while (cap < run->nglyphs + len - run->len)
+			cap *= 2;
+		if (!(glyphs = realloc(run->glyphs, sizeof(float) * gc->stride * cap))) {
+			LOG_ERROR("no memory for %zu glyphs", cap);
+			return 0;
+		}
+		run->glyphs = glyphs;
+		run->cap = cap;
+		grown = 1;
+	}
+	if (!(t = realloc(run->s, len)))
+		return 0;
+	run->s = t;
+	memcpy(run->s + run->len, s + run->len, len - run->len);
+
+	from = run->nglyphs;
+	for (i = run->len; i < len; ++i) {
+		if (s[i] == '\n') {
+			run->penx = 0;
+			run->peny += 2 * gc->spriteh[run->font];
+			continue;
+		}
+		c = s[i] - 32;
+		sprite_emit(gc, run->font, run->x + run->penx, run->y + run->peny, run->z,
+			c % 10, c / 10, FLAT, run->glyphs + run->nglyphs++ * gc->stride);
+		/* move one width to the right */
+		run->penx += 2 * gc->spritew[run->font];
+	}
+	run->len = len;
+
+	glBindBuffer(GL_ARRAY_BUFFER, run->vbo);
+	if (grown) {
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * gc->stride * run->cap, NULL, GL_DYNAMIC_DRAW);
+		from = 0;
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * gc->stride * from,
+		sizeof(float) * gc->stride * (run->nglyphs - from),
+		run->glyphs + gc->stride * from);
+	return 1;
+}
+
+/**
+ * Find the cached region at `rx', `ry' of layer `z', taking over a free or
+ * the least recently drawn one if it is not there
+ * Returns NULL if no framebuffer could be made for it
+ */
+static CachedRegion *
+cache_region(Gc *gc, unsigned long key, int z, int rx, int ry)
+{
+	size_t i;
+	GLenum status;
+	CachedRegion *r, *victim;
+
+	victim = NULL;
+	for (i = 0; i < CACHE_REGIONS; ++i) {
+		r = &gc->regions[i];
+		if (r->key == key && r->z == z && r->rx == rx && r->ry == ry)
+			return r;
+		if (!victim || (victim->key && (!r->key || r->frame < victim->frame)))
+			victim = r;
+	}
+	r = victim;
+	if (!r->fbo) {
+		glGenTextures(1, &r->tex);
+		state_texture(gc, r->tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, gc->w, gc->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glGenFramebuffers(1, &r->fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, r->tex, 0);
+		status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			LOG_ERROR("cannot draw static layers into textures");
+			glDeleteFramebuffers(1, &r->fbo);
+			state_texture(gc, 0);
+			glDeleteTextures(1, &r->tex);
+			r->fbo = r->tex = 0;
+			return NULL;
+		}
+	}
+	r->key = key;
+	r->z = z;
+	r->rx = rx;
+	r->ry = ry;
+	r->valid = 0;
+	return r;
+}
+
+/**
+ * Draw the content of a region into its texture
+ */
+static void
+cache_fill(Gc *gc, CachedRegion *r, void (*fn)(Gc *, int, int, int, int, int, void *), void *ctx)
+{
+	GLint viewport[4];
+	Camera cam;
+	int batching;
+
+	cam = gc->cam;
+	batching = gc->batching;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+	glViewport(0, 0, gc->w, gc->h);
+	glClearColor(0.f, 0.f, 0.f, 0.f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(1.f, 1.f, 1.f, 1.f);
+	gc->cam.x = r->rx * 2 * gc->w;
+	gc->cam.y = r->ry * 2 * gc->h;
+	gc->cam.zoom = 1.f;
+	gc->batching = 1;
+	fn(gc, r->z, gc->cam.x, gc->cam.y, gc->cam.x + 2 * gc->w, gc->cam.y + 2 * gc->h, ctx);
+	gc_queue_submit(gc);
+	batch_draw(gc);
+	gc->cam = cam;
+	gc->batching = batching;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	r->valid = 1;
+}
+
+static int
+floordiv(int a, int b)
+{
+	return a / b - (a % b < 0);
+}
+
+static void
+state_program(Gc *gc, GLuint prog)
+{
+	if (gc->gl.prog == prog) {
+		++gc->stats.elided;
+		return;
+	}
+	glUseProgram(prog);
+	gc->gl.prog = prog;
+	++gc->stats.issued;
+}
+
+static void
+state_texture(Gc *gc, GLuint tex)
+{
+	if (gc->gl.tex == tex) {
+		++gc->stats.elided;
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D, tex);
+	gc->gl.tex = tex;
+	++gc->stats.issued;
+}
+
+static void
+state_vao(Gc *gc, GLuint vao)
+{
+	if (gc->gl.vao == vao) {
+		++gc->stats.elided;
+		return;
+	}
+	glBindVertexArray(vao);
+	gc->gl.vao = vao;
+	++gc->stats.issued;
+}
+
+/**
+ * Turn GL_BLEND or GL_DEPTH_TEST on or off
+ */
+static void
+state_enable(Gc *gc, GLenum cap, int on)
+{
+	int *cur;
+
+	cur = cap == GL_BLEND ? &gc->gl.blend : &gc->gl.depth_test;
+	if (*cur == !!on) {
+		++gc->stats.elided;
+		return;
+	}
+	if (on)
+		glEnable(cap);
+	else
+		glDisable(cap);
+	*cur = !!on;
+	++gc->stats.issued;
+}
+
+static void
+state_depth_mask(Gc *gc, int on)
+{
+	if (gc->gl.depth_mask == !!on) {
+		++gc->stats.elided;
+		return;
+	}
+	glDepthMask(on ? GL_TRUE : GL_FALSE);
+	gc->gl.depth_mask = !!on;
+	++gc->stats.issued;
+}
+
+static void
+state_depth_func(Gc *gc, GLenum func)
+{
+	if (gc->gl.depth_func == func) {
+		++gc->stats.elided;
+		return;
+	}
+	glDepthFunc(func);
+	gc->gl.depth_func = func;
+	++gc->stats.issued;
+}
+
+/**
+ * Set a uniform of `n' floats of the program in use
+ * Values are remembered per program, as GL does; once the shadow is full
+ * further uniforms are always uploaded
+ */
+static void
+state_uniform(Gc *gc, GLint loc, int n, const float *v)
+{
+	size_t i;
+
+	if (loc < 0)
+		return;
+	for (i = 0; i < gc->gl.nuniforms; ++i)
+		if (gc->gl.uniforms[i].prog == gc->gl.prog && gc->gl.uniforms[i].loc == loc)
+			break;
+	if (i < gc->gl.nuniforms && !memcmp(gc->gl.uniforms[i].v, v, sizeof(float) * n)) {
+		++gc->stats.elided;
+		return;
+	}
+	switch (n) {
+	case 1:
+		glUniform1fv(loc, 1, v);
+		break;
+	case 2:
+		glUniform2fv(loc, 1, v);
+		break;
+	default:
+		glUniform4fv(loc, 1, v);
+	}
+	++gc->stats.issued;
+	if (i == gc->gl.nuniforms) {
+		if (i == UNIFORM_SHADOWS)
+			return;
+		++gc->gl.nuniforms;
+		gc->gl.uniforms[i].prog = gc->gl.prog;
+		gc->gl.uniforms[i].loc = loc;
+	}
+	memcpy(gc->gl.uniforms[i].v, v, sizeof(float) * n);
+}
+
+static void
+state_uniform2f(Gc *gc, GLint loc, float x, float y)
+{
+	float v[2];
+
+	v[0] = x;
+	v[1] = y;
+	state_uniform(gc, loc, 2, v);
+}
+
+/**
+ * Update the uniform buffer of the core profile with the camera and
+ * alpha cutoff; laid out as the std140 `Frame' block of the shaders
+ */
+static void
+state_frame(Gc *gc)
+{
+	float v[8];
+
+	if (!gc->core)
+		return;
+	memset(v, 0, sizeof(v));
+	v[0] = gc->cam.x;
+	v[1] = gc->cam.y;
+	v[2] = gc->cam.zoom/(float)gc->w;
+	v[3] = gc->cam.zoom/(float)gc->h;
+	v[4] = gc->cutoff;
+	if (!memcmp(v, gc->gl.frame, sizeof(v))) {
+		++gc->stats.elided;
+		return;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, gc->frame_ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(v), v);
+	memcpy(gc->gl.frame, v, sizeof(v));
+	++gc->stats.issued;
+}
+
+static GLuint
+shader_compile(GLenum type, const char *src)
+{
+	char err[512];
+	GLuint shader;
+
+	shader = glCreateShader(type);
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	err[0] = '\0';
+	glGetShaderInfoLog(shader, 512, NULL, err);
+	if (*err)
+		LOG_ERROR("%s", err);
+	return shader;
+}
+
+/**
+ * Draw the quad of the bound `gc->vao'
+ */
+static void
+draw_quad(Gc *gc)
+{
+	if (gc->core)
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, 0);
+	else
+		glDrawArrays(GL_QUADS, 0, 4);
+}
+
 static void
 key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
 {
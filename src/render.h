@@ -33,16 +33,50 @@ typedef struct {
 	float dx, dy;
 } Input;
 
+/* GL state changes issued and skipped for being redundant */
+typedef struct {
+	unsigned long issued, elided;
+} GcStats;
+
+/* view onto drawing coordinates; `x', `y' is the top left corner */
+typedef struct {
+	int x, y;
+	float zoom;
+} Camera;
+
+/* GL flavour set up by `gc_init' */
+enum gc_profile {
+	GC_PROFILE_LEGACY, /* GL 2.1, instancing if GL 3.3 is there */
+	GC_PROFILE_CORE /* GL 3.3 core profile */
+};
+
 Gc * gc_new(void);
-int gc_init(Gc *);
+int gc_init(Gc *, enum gc_profile);
 int gc_create_sprite(Gc *, const Image *, unsigned int, unsigned int);
 void gc_draw(Gc *, int, int, int, int, int, int);
+void gc_batch_begin(Gc *);
+void gc_batch_push(Gc *, int, int, int, int, int, int);
+void gc_batch_flush(Gc *);
+void gc_queue_push(Gc *, int, int, int, int, int, int);
+void gc_queue_submit(Gc *);
+void gc_set_depth_test(Gc *, int);
+void gc_draw_cached(Gc *, unsigned long, int, void (*)(Gc *, int, int, int, int, int, void *), void *);
+void gc_invalidate_cache(Gc *, unsigned long, int, int, int, int, int);
+void gc_get_stats(const Gc *, GcStats *);
+int gc_visible(const Gc *, int, int, int);
+void gc_sprite_size(const Gc *, int, int *, int *);
+void gc_get_size(const Gc *, int *, int *);
+int gc_refresh_rate(const Gc *);
+void gc_set_camera(Gc *, const Camera *);
+void gc_get_view(const Gc *, int *, int *, int *, int *);
 void gc_print(Gc *, int, int, int, int, const char *, size_t);
 void gc_clear(Gc *);
 void gc_commit(Gc *);
+void gc_poll_events(const Gc *);
+int gc_dump(const Gc *, const char *);
 int gc_alive(const Gc *);
 void gc_select(const Gc *);
+void gc_release(const Gc *);
 void gc_set_resolution(const Gc *, unsigned int, unsigned int);
-int gc_check_timer(double);
 void gc_bind_input(const Gc *);
 Input gc_poll_input(void);
@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Queue of draw commands ordered by 64-bit sort keys
+ * Keys are sorted with an LSD radix sort a byte at a time; bytes equal
+ * across the whole queue are skipped, so the usual frame where only a few
+ * layers and textures are in use takes far fewer than eight passes.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "rqueue.h"
+
+typedef struct {
+	uint64_t key;
+	uint32_t cmd; /* index into `cmds' */
+} Entry;
+
+struct rqueue {
+	RenderCmd *cmds;
+	Entry *entries, *tmp;
+	size_t n, cap;
+};
+
+static int rqueue_grow(RenderQueue *);
+
+
+RenderQueue *
+rqueue_create(void)
+{
+	RenderQueue *q;
+
+	q = malloc(sizeof(RenderQueue));
+	if (!q)
+		return NULL;
+	q->cmds = NULL;
+	q->entries = q->tmp = NULL;
+	q->n = q->cap = 0;
+
+	return q;
+}
+
+void
+rqueue_destroy(RenderQueue *q)
+{
+	free(q->cmds);
+	free(q->entries);
+	free(q->tmp);
+	free(q);
+}
+
+void
+rqueue_clear(RenderQueue *q)
+{
+	q->n = 0;
+}
+
+/**
+ * Queue a command to be drawn in the order of `key'
+ * Commands of equal keys keep the order they were pushed in
+ */
+int
+rqueue_push(RenderQueue *q, uint64_t key, const RenderCmd *cmd)
+{
+	if (q->n == q->cap && !rqueue_grow(q)) {
+		LOG_ERROR("no memory to queue %zu commands", q->n + 1);
+		return 0;
+	}
+	q->cmds[q->n] = *cmd;
+	q->entries[q->n].key = key;
+	q->entries[q->n].cmd = q->n;
+	++q->n;
+
+	return 1;
+}
+
+/**
+ * Order the queued commands by their keys
+ * Returns the amount of commands
+ */
+size_t
+rqueue_sort(RenderQueue *q)
+{
+	size_t count[256], i, shift;
+	uint64_t diff;
+	Entry *t;
+
+	if (q->n < 2)
+		return q->n;
+	/* only bytes that differ somewhere need a pass */
+	for (diff = 0, i = 1; i < q->n; ++i)
+		diff |= q->entries[i].key ^ q->entries[0].key;
+	for (shift = 0; shift < 64; shift += 8) {
+		if (!((diff >> shift) & 0xff))
+			continue;
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < q->n; ++i)
+			++count[(q->entries[i].key >> shift) & 0xff];
+		for (i = 1; i < 256; ++i)
+			count[i] += count[i - 1];
+		/* going backwards keeps the sort stable */
+		for (i = q->n; i--;)
+			q->tmp[--count[(q->entries[i].key >> shift) & 0xff]] = q->entries[i];
+		t = q->entries;
+		q->entries = q->tmp;
+		q->tmp = t;
+	}
+
+	return q->n;
+}
+
+/**
+ * Get the `i'th command in the sorted order
+ */
+const RenderCmd *
+rqueue_get(const RenderQueue *q, size_t i)
+{
+	return &q->cmds[q->entries[i].cmd];
+}
+
+/**
+ * Make a key drawing `layer' over lower ones; within a layer greater
+ * `depth' comes on top, ties are grouped by `texture' to save switches
+ */
+uint64_t
+rqueue_key(unsigned int layer, int depth, unsigned int texture)
+{
+	uint64_t d;
+
+	/* flip the sign bit so that negative depths sort first */
+	d = (uint32_t)depth ^ 0x80000000u;
+	return ((uint64_t)(layer & ((1u << RQ_LAYER_BITS) - 1)) << (RQ_DEPTH_BITS + RQ_TEXTURE_BITS))
+		| (d << RQ_TEXTURE_BITS)
+		| (texture & ((1u << RQ_TEXTURE_BITS) - 1));
+}
+
+static int
+rqueue_grow(RenderQueue *q)
+{
+	size_t cap;
+	RenderCmd *cmds;
+	Entry *e;
+
+	cap = q->cap ? q->cap * 2 : 256;
+	if (!(cmds = realloc(q->cmds, sizeof(RenderCmd) * cap)))
+		return 0;
+	q->cmds = cmds;
+	if (!(e = realloc(q->entries, sizeof(Entry) * cap)))
+		return 0;
+	q->entries = e;
+	if (!(e = realloc(q->tmp, sizeof(Entry) * cap)))
+		return 0;
+	q->tmp = e;
+	q->cap = cap;
+
+	return 1;
+}
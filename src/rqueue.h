@@ -0,0 +1,46 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Queue of draw commands ordered by 64-bit sort keys
+ */
+
+#define RQ_LAYER_BITS 8
+#define RQ_DEPTH_BITS 32
+#define RQ_TEXTURE_BITS 24
+
+/* sprite draw as taken by `gc_draw' */
+typedef struct {
+	int sprite, x, y, z, ox, oy;
+} RenderCmd;
+
+typedef struct rqueue RenderQueue;
+
+RenderQueue * rqueue_create(void);
+void rqueue_destroy(RenderQueue *);
+void rqueue_clear(RenderQueue *);
+int rqueue_push(RenderQueue *, uint64_t, const RenderCmd *);
+size_t rqueue_sort(RenderQueue *);
+const RenderCmd * rqueue_get(const RenderQueue *, size_t);
+uint64_t rqueue_key(unsigned int, int, unsigned int);
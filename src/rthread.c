@@ -0,0 +1,170 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Thread replaying recorded frames on the graphical context
+ * Two command lists take turns: the simulation records a frame into one
+ * while the render thread replays and presents the other, so that a
+ * buffer swap waiting for vsync holds up neither ticks nor recording.
+ * The context belongs to the render thread from creation until the thread
+ * is destroyed; the caller must not touch it meanwhile.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "ff.h"
+#include "render.h"
+#include "cmdlist.h"
+#include "rthread.h"
+
+struct render_thread {
+	pthread_t thread;
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	Gc *gc;
+	CmdList *lists[2];
+	int recording; /* index of the list being recorded */
+	int pending; /* the other list waits to be replayed */
+	int quit;
+}; /* type RenderThread */
+
+static void * rthread_loop(void *);
+
+
+/**
+ * Hand the context of `gc' over to a new render thread
+ */
+RenderThread *
+rthread_create(Gc *gc)
+{
+	RenderThread *rt;
+
+	if (!(rt = calloc(sizeof(RenderThread), 1))) {
+		LOG_PERROR("failed to allocate render thread");
+		return NULL;
+	}
+	rt->gc = gc;
+	if (!(rt->lists[0] = cmdlist_create(gc)) || !(rt->lists[1] = cmdlist_create(gc))) {
+		LOG_ERROR("failed to create command lists");
+		goto err;
+	}
+	pthread_mutex_init(&rt->mtx, NULL);
+	pthread_cond_init(&rt->cond, NULL);
+	gc_release(gc);
+	if (pthread_create(&rt->thread, NULL, rthread_loop, rt)) {
+		LOG_ERROR("failed to start render thread");
+		pthread_cond_destroy(&rt->cond);
+		pthread_mutex_destroy(&rt->mtx);
+		gc_select(gc);
+		goto err;
+	}
+
+	return rt;
+
+err:	if (rt->lists[0])
+		cmdlist_destroy(rt->lists[0]);
+	if (rt->lists[1])
+		cmdlist_destroy(rt->lists[1]);
+	free(rt);
+	return NULL;
+}
+
+/**
+ * Present the last frame submitted, stop the thread and give the context
+ * back to the caller
+ */
+void
+rthread_destroy(RenderThread *rt)
+{
+	pthread_mutex_lock(&rt->mtx);
+	rt->quit = 1;
+	pthread_cond_broadcast(&rt->cond);
+	pthread_mutex_unlock(&rt->mtx);
+	pthread_join(rt->thread, NULL);
+	gc_select(rt->gc);
+	pthread_cond_destroy(&rt->cond);
+	pthread_mutex_destroy(&rt->mtx);
+	cmdlist_destroy(rt->lists[0]);
+	cmdlist_destroy(rt->lists[1]);
+	free(rt);
+}
+
+/**
+ * Get the list to record the next frame into
+ */
+CmdList *
+rthread_list(RenderThread *rt)
+{
+	return rt->lists[rt->recording];
+}
+
+/**
+ * Pass the recorded frame on to be replayed
+ * Waits for the frame before it to be done with, whose list is then
+ * emptied for recording
+ */
+void
+rthread_submit(RenderThread *rt)
+{
+	pthread_mutex_lock(&rt->mtx);
+	while (rt->pending)
+		pthread_cond_wait(&rt->cond, &rt->mtx);
+	rt->recording = !rt->recording;
+	rt->pending = 1;
+	pthread_cond_broadcast(&rt->cond);
+	pthread_mutex_unlock(&rt->mtx);
+	cmdlist_reset(rt->lists[rt->recording]);
+}
+
+static void *
+rthread_loop(void *arg)
+{
+	RenderThread *rt;
+	CmdList *l;
+
+	rt = arg;
+	gc_select(rt->gc);
+	pthread_mutex_lock(&rt->mtx);
+	for (;;) {
+		while (!rt->pending && !rt->quit)
+			pthread_cond_wait(&rt->cond, &rt->mtx);
+		if (!rt->pending)
+			break;
+		l = rt->lists[!rt->recording];
+		pthread_mutex_unlock(&rt->mtx);
+		cmdlist_replay(l, rt->gc);
+		gc_commit(rt->gc);
+		pthread_mutex_lock(&rt->mtx);
+		rt->pending = 0;
+		pthread_cond_broadcast(&rt->cond);
+	}
+	pthread_mutex_unlock(&rt->mtx);
+	gc_release(rt->gc);
+
+	return NULL;
+}
@@ -38,7 +38,6 @@
 #include "entity.h"
 
 #define MAX_SCHEDS 256
-#define MAX_COLLS 256
 
 
 static struct {
@@ -48,12 +47,6 @@ static struct {
 	size_t n;
 } schedtab;
 
-static struct {
-	int active[MAX_COLLS], first_entity[MAX_COLLS], second_entity[MAX_COLLS], recurring[MAX_COLLS];
-	EntityManager *emgr[MAX_COLLS];
-	void *ctx[MAX_COLLS], (*fn[MAX_COLLS])(int, int, void *);
-	size_t n;
-} collisiontab;
 
 int
 schedule(unsigned long tick, void (*fn)(unsigned long, void *), void *data)
@@ -91,48 +84,3 @@ schedule_poll(unsigned int tick)
 		}
 	}
 }
-
-int
-set_collsion(EntityManager *emgr, int first_entity, int second_entity, void (*fn)(int, int, void *), void *data)
-{
-	size_t i;
-
-	for (i = 0; i < collisiontab.n; ++i) {
-		if (!collisiontab.active[i])
-			break;
-	}
-	if (i >= MAX_COLLS) {
-		LOG_ERROR("reached limit of active collision events (%zu)", i);
-		return -1;
-	}
-	if (i == collisiontab.n)
-		++collisiontab.n;
-	collisiontab.first_entity[i] = first_entity;
-	collisiontab.second_entity[i] = second_entity;
-	collisiontab.emgr[i] = emgr;
-	collisiontab.fn[i] = fn;
-	collisiontab.ctx[i] = data;
-	collisiontab.active[i] = 1;
-	LOG_TRACE("added collision event #%zu", i);
-
-	return i;
-}
-
-void
-collision_poll(unsigned int tick)
-{
-	size_t i;
-	int result;
-
-	for (i = 0; i < collisiontab.n; ++i) {
-		if (!collisiontab.active[i])
-			continue;
-		result = entity_detect_collision(collisiontab.emgr[i], collisiontab.first_entity[i], collisiontab.second_entity[i], collisiontab.fn[i], collisiontab.ctx[i]);
-		if (result < 0) {
-			LOG_WARNING("entity #%d or #%d does not exist; removing collision event #%zu", collisiontab.first_entity[i], collisiontab.second_entity[i], i);
-			collisiontab.active[i] = 0;
-		}
-		if (result && !collisiontab.recurring[i])
-			collisiontab.active[i] = 0;
-	}
-}
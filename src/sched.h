@@ -28,5 +28,3 @@
 
 int schedule(unsigned long, void (*)(unsigned long, void *), void *);
 void schedule_poll(unsigned int);
-int set_collsion(EntityManager *, int, int, void (*fn)(int, int, void *), void *);
-void collision_poll(unsigned int);
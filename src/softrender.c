@@ -0,0 +1,587 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * Render images on the CPU
+ * Implements the interface of `render.c' without GL nor a window by
+ * drawing into an RGBA8 framebuffer with nearest sampling; picked at build
+ * time for machines without a GPU. Frames go nowhere unless dumped as
+ * farbfeld images, see `gc_dump'.
+ * Environment:
+ *   TAKKUSU_FRAMES  frames to draw before `gc_alive' returns 0
+ *   TAKKUSU_DUMP    printf pattern of farbfeld files to dump frames to,
+ *                   given the frame number, e.g. `frame%04lu.ff'
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+# define SOFT_SSE2
+# include <emmintrin.h>
+#endif /* __GNUC__ && __SSE2__ */
+
+#include "log.h"
+#include "ff.h"
+#include "render.h"
+#include "rqueue.h"
+
+#define SPRITE_LIMIT 512
+#define DEPTH_LAYERS 16 /* zpos values told apart by the depth buffer */
+#define FLAT (-1e9f) /* base of sprites lying flat at the back of their layer */
+#define ALPHA_CUTOFF 127 /* alpha up to which depth tested pixels are dropped */
+
+typedef struct {
+	uint8_t *d; /* RGBA8 */
+	size_t w, h; /* of the sheet */
+	size_t fw, fh; /* of a frame */
+	int translucent; /* has pixels neither clear nor opaque */
+} Sheet;
+
+struct gc {
+	Sheet sprites[SPRITE_LIMIT];
+	size_t nsprites;
+	int w, h;
+	uint8_t *fb; /* RGBA8, rows top down */
+	float *zb; /* depth, smaller is closer */
+	uint32_t *row; /* source pixels of the span being drawn */
+	int *cols;
+	Camera cam;
+	RenderQueue *queue;
+	int depth;
+	int strict; /* depth ties are rejected, like GL_LESS */
+	unsigned long frame, frames;
+	const char *dump;
+};
+
+static void blit(Gc *, int, int, int, int, int, int, float);
+static void blend_span(uint8_t *, const uint32_t *, size_t);
+static float sprite_depth(const Gc *, int, float);
+
+static Input global_input;
+static pthread_mutex_t frame_mtx = PTHREAD_MUTEX_INITIALIZER; /* frames are counted on the render thread */
+
+
+Gc *
+gc_new(void)
+{
+	return malloc(sizeof(Gc));
+}
+
+/**
+ * Allocate the framebuffer; `profile' has no meaning here
+ */
+int
+gc_init(Gc *gc, enum gc_profile profile)
+{
+	const char *frames;
+
+	gc->nsprites = 0;
+	gc->w = 640;
+	gc->h = 480;
+	gc->depth = 0;
+	gc->strict = 0;
+	gc->frame = 0;
+	gc->frames = (frames = getenv("TAKKUSU_FRAMES")) ? strtoul(frames, NULL, 10) : 0;
+	gc->dump = getenv("TAKKUSU_DUMP");
+	gc->fb = malloc((size_t)gc->w * gc->h * 4);
+	gc->zb = malloc(sizeof(float) * gc->w * gc->h);
+	gc->row = malloc(sizeof(uint32_t) * gc->w);
+	gc->cols = malloc(sizeof(int) * gc->w);
+	gc->queue = rqueue_create();
+	if (!gc->fb || !gc->zb || !gc->row || !gc->cols || !gc->queue) {
+		LOG_ERROR("failed allocating a %dx%d framebuffer", gc->w, gc->h);
+		return -1;
+	}
+	gc_set_camera(gc, NULL);
+	gc_clear(gc);
+	LOG_INFO("rendering %dx%d frames in software", gc->w, gc->h);
+
+	return 0;
+}
+
+/**
+ * Load a sheet of `w' by `h' frames
+ */
+int
+gc_create_sprite(Gc *gc, const Image *img, unsigned int w, unsigned int h)
+{
+	Sheet *s;
+	size_t i;
+	float c;
+
+	if (gc->nsprites >= SPRITE_LIMIT)
+		return -1;
+	s = &gc->sprites[gc->nsprites];
+	if (!(s->d = malloc(img->w * img->h * 4)))
+		return -1;
+	s->w = img->w;
+	s->h = img->h;
+	s->fw = w;
+	s->fh = h;
+	s->translucent = image_translucent(img);
+	if (img->fmt == IMAGE_RGBA8) {
+		memcpy(s->d, img->d, img->siz);
+		return gc->nsprites++;
+	}
+	for (i = 0; i < img->siz; ++i) {
+		switch (img->fmt) {
+		case IMAGE_RGBA8:
+			break;
+		case IMAGE_RGBA16:
+			s->d[i] = ((uint32_t)((const uint16_t *)img->d)[i] * 255 + 32767) / 65535;
+			break;
+		case IMAGE_FLOAT:
+			c = ((const float *)img->d)[i];
+			c = c < 0.f ? 0.f : c > 1.f ? 1.f : c;
+			s->d[i] = c * 255.f + .5f;
+			break;
+		}
+	}
+	return gc->nsprites++;
+}
+
+void
+gc_draw(Gc *gc, int sprite, int x, int y, int z, int ox, int oy)
+{
+	/* keep the order of sprites queued earlier */
+	gc_queue_submit(gc);
+	blit(gc, sprite, x, y, z, ox, oy, FLAT);
+}
+
+void
+gc_batch_begin(Gc *gc)
+{
+}
+
+/**
+ * Sprites are drawn right away; there is nothing to batch
+ */
+void
+gc_batch_push(Gc *gc, int sprite, int x, int y, int z, int ox, int oy)
+{
+	blit(gc, sprite, x, y, z, ox, oy, FLAT);
+}
+
+void
+gc_batch_flush(Gc *gc)
+{
+	gc_queue_submit(gc);
+}
+
+void
+gc_queue_push(Gc *gc, int sprite, int x, int y, int z, int ox, int oy)
+{
+	RenderCmd cmd;
+
+	cmd.sprite = sprite;
+	cmd.x = x;
+	cmd.y = y;
+	cmd.z = z;
+	cmd.ox = ox;
+	cmd.oy = oy;
+	rqueue_push(gc->queue, rqueue_key(z < 0 ? 0 : z, y + (int)gc->sprites[sprite].fh, sprite), &cmd);
+}
+
+/**
+ * Draw the queued sprites in the order `render.c' would
+ */
+void
+gc_queue_submit(Gc *gc)
+{
+	size_t i, n;
+	const RenderCmd *c;
+
+	n = rqueue_sort(gc->queue);
+	if (!gc->depth) {
+		for (i = 0; i < n; ++i) {
+			c = rqueue_get(gc->queue, i);
+			blit(gc, c->sprite, c->x, c->y, c->z, c->ox, c->oy, c->y + gc->sprites[c->sprite].fh);
+		}
+		rqueue_clear(gc->queue);
+		return;
+	}
+	/* the first of opaque sprites drawn front to back wins ties */
+	gc->strict = 1;
+	for (i = n; i--;) {
+		c = rqueue_get(gc->queue, i);
+		if (!gc->sprites[c->sprite].translucent)
+			blit(gc, c->sprite, c->x, c->y, c->z, c->ox, c->oy, c->y + gc->sprites[c->sprite].fh);
+	}
+	gc->strict = 0;
+	for (i = 0; i < n; ++i) {
+		c = rqueue_get(gc->queue, i);
+		if (gc->sprites[c->sprite].translucent)
+			blit(gc, c->sprite, c->x, c->y, c->z, c->ox, c->oy, c->y + gc->sprites[c->sprite].fh);
+	}
+	rqueue_clear(gc->queue);
+}
+
+void
+gc_set_depth_test(Gc *gc, int on)
+{
+	gc_queue_submit(gc);
+	gc->depth = on;
+}
+
+/**
+ * Static layers are cheap enough to draw every time here
+ */
+void
+gc_draw_cached(Gc *gc, unsigned long key, int z,
+	void (*fn)(Gc *, int, int, int, int, int, void *), void *ctx)
+{
+	int x0, y0, x1, y1;
+
+	gc_queue_submit(gc);
+	gc_get_view(gc, &x0, &y0, &x1, &y1);
+	fn(gc, z, x0, y0, x1, y1, ctx);
+}
+
+void
+gc_invalidate_cache(Gc *gc, unsigned long key, int z, int x0, int y0, int x1, int y1)
+{
+}
+
+void
+gc_get_stats(const Gc *gc, GcStats *stats)
+{
+	stats->issued = stats->elided = 0;
+}
+
+int
+gc_visible(const Gc *gc, int sprite, int x, int y)
+{
+	int x0, y0, x1, y1;
+
+	gc_get_view(gc, &x0, &y0, &x1, &y1);
+	return x + (int)gc->sprites[sprite].fw > x0 && x - (int)gc->sprites[sprite].fw < x1
+		&& y + (int)gc->sprites[sprite].fh > y0 && y - (int)gc->sprites[sprite].fh < y1;
+}
+
+void
+gc_sprite_size(const Gc *gc, int sprite, int *w, int *h)
+{
+	*w = gc->sprites[sprite].fw;
+	*h = gc->sprites[sprite].fh;
+}
+
+/**
+ * Frames are not tied to a display here
+ */
+int
+gc_refresh_rate(const Gc *gc)
+{
+	return 0;
+}
+
+void
+gc_get_size(const Gc *gc, int *w, int *h)
+{
+	*w = gc->w;
+	*h = gc->h;
+}
+
+void
+gc_set_camera(Gc *gc, const Camera *cam)
+{
+	gc_queue_submit(gc);
+	if (!cam) {
+		gc->cam.x = gc->cam.y = 0;
+		gc->cam.zoom = 1.f;
+		return;
+	}
+	gc->cam = *cam;
+	if (gc->cam.zoom <= 0.f)
+		gc->cam.zoom = 1.f;
+}
+
+void
+gc_get_view(const Gc *gc, int *x0, int *y0, int *x1, int *y1)
+{
+	*x0 = gc->cam.x;
+	*y0 = gc->cam.y;
+	*x1 = gc->cam.x + (int)(2 * gc->w / gc->cam.zoom);
+	*y1 = gc->cam.y + (int)(2 * gc->h / gc->cam.zoom);
+}
+
+void
+gc_print(Gc *gc, int sprite, int x, int y, int z, const char *s, size_t len)
+{
+	size_t i;
+	int c, px, py;
+
+	if (!len)
+		len = strlen(s);
+	gc_queue_submit(gc);
+	px = py = 0;
+	for (i = 0; i < len; ++i) {
+		if (s[i] == '\n') {
+			px = 0;
+			py += 2 * gc->sprites[sprite].fh;
+			continue;
+		}
+		c = s[i] - 32;
+		blit(gc, sprite, x + px, y + py, z, c % 10, c / 10, FLAT);
+		px += 2 * gc->sprites[sprite].fw;
+	}
+}
+
+void
+gc_clear(Gc *gc)
+{
+	size_t i;
+
+	memset(gc->fb, 0xff, (size_t)gc->w * gc->h * 4);
+	for (i = 0; i < (size_t)gc->w * gc->h; ++i)
+		gc->zb[i] = 1.f;
+}
+
+void
+gc_commit(Gc *gc)
+{
+	char path[FILENAME_MAX];
+
+	if (gc->dump) {
+		snprintf(path, sizeof(path), gc->dump, gc->frame);
+		gc_dump(gc, path);
+	}
+	pthread_mutex_lock(&frame_mtx);
+	++gc->frame;
+	pthread_mutex_unlock(&frame_mtx);
+}
+
+void
+gc_poll_events(const Gc *gc)
+{
+}
+
+int
+gc_alive(const Gc *gc)
+{
+	int alive;
+
+	pthread_mutex_lock(&frame_mtx);
+	alive = !gc->frames || gc->frame < gc->frames;
+	pthread_mutex_unlock(&frame_mtx);
+	return alive;
+}
+
+void
+gc_select(const Gc *gc)
+{
+}
+
+void
+gc_release(const Gc *gc)
+{
+}
+
+void
+gc_set_resolution(const Gc *gc, unsigned int width, unsigned int height)
+{
+	LOG_WARNING("software frames stay %dx%d", gc->w, gc->h);
+}
+
+void
+gc_bind_input(const Gc *gc)
+{
+}
+
+Input
+gc_poll_input(void)
+{
+	return global_input;
+}
+
+/**
+ * Write the framebuffer as a farbfeld image
+ */
+int
+gc_dump(const Gc *gc, const char *path)
+{
+	FILE *f;
+	uint8_t hdr[16], px[8];
+	size_t i;
+	int j;
+
+	if (!(f = fopen(path, "wb"))) {
+		LOG_ERROR("cannot open %s for writing", path);
+		return -1;
+	}
+	memcpy(hdr, "farbfeld", 8);
+	for (j = 0; j < 4; ++j) {
+		hdr[8 + j] = (uint32_t)gc->w >> (24 - 8 * j);
+		hdr[12 + j] = (uint32_t)gc->h >> (24 - 8 * j);
+	}
+	fwrite(hdr, 1, sizeof(hdr), f);
+	/* 16 bits per channel, big endian */
+	for (i = 0; i < (size_t)gc->w * gc->h; ++i) {
+		for (j = 0; j < 4; ++j)
+			px[2 * j] = px[2 * j + 1] = gc->fb[4 * i + j];
+		fwrite(px, 1, sizeof(px), f);
+	}
+	if (fclose(f)) {
+		LOG_ERROR("failed writing %s", path);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Draw a frame of a sprite centered at `x', `y' in drawing coordinates,
+ * the same area the GL backend covers; `base' gives the depth as in its
+ * shaders
+ */
+static void
+blit(Gc *gc, int sprite, int x, int y, int z, int ox, int oy, float base)
+{
+	Sheet *s;
+	float fx0, fy0, fx1, fy1, depth, *zb;
+	int px0, py0, px1, py1, px, py, v, n;
+	const uint8_t *src;
+	uint8_t *dst;
+	uint32_t p;
+
+	s = &gc->sprites[sprite];
+	if (ox < 0 || oy < 0 || (ox + 1) * s->fw > s->w || (oy + 1) * s->fh > s->h)
+		return;
+	/* a sprite spans twice its frame in drawing coordinates, which are
+	 * twice the pixels */
+	fx0 = (float)(x - gc->cam.x - (int)s->fw) * gc->cam.zoom / 2.f;
+	fx1 = (float)(x - gc->cam.x + (int)s->fw) * gc->cam.zoom / 2.f;
+	fy0 = (float)(y - gc->cam.y - (int)s->fh) * gc->cam.zoom / 2.f;
+	fy1 = (float)(y - gc->cam.y + (int)s->fh) * gc->cam.zoom / 2.f;
+	/* pixels whose centres are covered */
+	px0 = ceilf(fx0 - .5f);
+	px1 = ceilf(fx1 - .5f);
+	py0 = ceilf(fy0 - .5f);
+	py1 = ceilf(fy1 - .5f);
+	px0 = px0 > 0 ? px0 : 0;
+	py0 = py0 > 0 ? py0 : 0;
+	px1 = px1 < gc->w ? px1 : gc->w;
+	py1 = py1 < gc->h ? py1 : gc->h;
+	if (px0 >= px1 || py0 >= py1)
+		return;
+	n = px1 - px0;
+	for (px = px0; px < px1; ++px) {
+		v = (px + .5f - fx0) / (fx1 - fx0) * s->fw;
+		gc->cols[px - px0] = ox * s->fw + (v < (int)s->fw ? v : (int)s->fw - 1);
+	}
+	depth = sprite_depth(gc, z, base);
+	for (py = py0; py < py1; ++py) {
+		v = (py + .5f - fy0) / (fy1 - fy0) * s->fh;
+		v = oy * s->fh + (v < (int)s->fh ? v : (int)s->fh - 1);
+		src = s->d + (size_t)v * s->w * 4;
+		for (px = 0; px < n; ++px)
+			memcpy(&gc->row[px], src + (size_t)gc->cols[px] * 4, 4);
+		dst = gc->fb + ((size_t)py * gc->w + px0) * 4;
+		if (gc->depth) {
+			zb = gc->zb + (size_t)py * gc->w + px0;
+			for (px = 0; px < n; ++px) {
+				p = gc->row[px];
+				/* clear the source where it would be discarded */
+				if (((uint8_t *)&p)[3] <= ALPHA_CUTOFF || depth > zb[px]
+					|| (gc->strict && depth == zb[px])) {
+					gc->row[px] = 0;
+					continue;
+				}
+				if (!s->translucent)
+					zb[px] = depth;
+			}
+		}
+		blend_span(dst, gc->row, n);
+	}
+}
+
+/**
+ * Blend `n' pixels over `dst' like the GL backend: colour by source
+ * alpha, alpha accumulated
+ * Divisions by 255 are rounded the same way in both variants
+ */
+static void
+blend_span(uint8_t *dst, const uint32_t *src, size_t n)
+{
+	size_t i, j;
+	unsigned int a, f, t;
+	const uint8_t *s;
+#ifdef SOFT_SSE2
+	__m128i zero, full, amask, sv, dv, s0, s1, d0, d1, a0, a1, f0, f1;
+
+	zero = _mm_setzero_si128();
+	full = _mm_set1_epi16(255);
+	/* alpha lanes of two unpacked pixels */
+	amask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+	for (i = 0; i + 4 <= n; i += 4) {
+		sv = _mm_loadu_si128((const __m128i *)&src[i]);
+		dv = _mm_loadu_si128((const __m128i *)&dst[4 * i]);
+		s0 = _mm_unpacklo_epi8(sv, zero);
+		s1 = _mm_unpackhi_epi8(sv, zero);
+		d0 = _mm_unpacklo_epi8(dv, zero);
+		d1 = _mm_unpackhi_epi8(dv, zero);
+		/* broadcast alpha of every pixel over its lanes */
+		a0 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s0, 0xff), 0xff);
+		a1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s1, 0xff), 0xff);
+		/* source factor is alpha for colour and one for alpha */
+		f0 = _mm_or_si128(_mm_andnot_si128(amask, a0), _mm_and_si128(amask, full));
+		f1 = _mm_or_si128(_mm_andnot_si128(amask, a1), _mm_and_si128(amask, full));
+		s0 = _mm_add_epi16(_mm_mullo_epi16(s0, f0), _mm_mullo_epi16(d0, _mm_sub_epi16(full, a0)));
+		s1 = _mm_add_epi16(_mm_mullo_epi16(s1, f1), _mm_mullo_epi16(d1, _mm_sub_epi16(full, a1)));
+		s0 = _mm_add_epi16(s0, _mm_set1_epi16(128));
+		s1 = _mm_add_epi16(s1, _mm_set1_epi16(128));
+		s0 = _mm_srli_epi16(_mm_add_epi16(s0, _mm_srli_epi16(s0, 8)), 8);
+		s1 = _mm_srli_epi16(_mm_add_epi16(s1, _mm_srli_epi16(s1, 8)), 8);
+		_mm_storeu_si128((__m128i *)&dst[4 * i], _mm_packus_epi16(s0, s1));
+	}
+#else
+	i = 0;
+#endif /* SOFT_SSE2 */
+	for (; i < n; ++i) {
+		s = (const uint8_t *)&src[i];
+		a = s[3];
+		for (j = 0; j < 4; ++j) {
+			f = j == 3 ? 255 : a;
+			t = s[j] * f + dst[4 * i + j] * (255 - a) + 128;
+			dst[4 * i + j] = (t + (t >> 8)) >> 8;
+		}
+	}
+}
+
+/**
+ * Get depth of a sprite in layer `z' as the shaders of `render.c' do
+ */
+static float
+sprite_depth(const Gc *gc, int z, float base)
+{
+	float f;
+
+	z = z < 0 ? 0 : z >= DEPTH_LAYERS ? DEPTH_LAYERS - 1 : z;
+	f = (base - gc->cam.y) * gc->cam.zoom / gc->h * .5f;
+	f = f < 0.f ? 0.f : f > .999f ? .999f : f;
+	return 1.f - (z + f) / (DEPTH_LAYERS / 2);
+}
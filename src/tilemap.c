@@ -0,0 +1,372 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ *
+ * Layered maps of tiles sharing a single tileset sprite
+ * Every layer is split into square chunks of tile indices allocated on the
+ * first write, so empty parts of a map take no memory. Tile `n' is drawn
+ * with the `n - 1'th frame of the tileset; `TILE_EMPTY' is not drawn.
+ * Layers are drawn through the renderer's cache of static content; chunks
+ * changed since the last drawing have their part of the cache redrawn.
+ * The cache is drawn from copies of the chunks kept where the frames are
+ * replayed, updated by the frames themselves, so the map may change while
+ * an earlier frame is being drawn on the render thread.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "ff.h"
+#include "render.h"
+#include "cmdlist.h"
+#include "tilemap.h"
+
+#define TILE_CHUNK 16 /* edge of a chunk in tiles */
+#define NTILES (UINT16_MAX + 1)
+
+typedef uint16_t Chunk[TILE_CHUNK * TILE_CHUNK];
+
+typedef struct {
+	size_t chunk; /* `SIZE_MAX' for the tileset alone */
+	int sprite;
+	unsigned int cols;
+	Chunk tiles;
+} TileUpdate;
+
+struct tilemap {
+	size_t w, h, nlayers; /* in tiles */
+	size_t cw, ch; /* in chunks */
+	int tilew, tileh; /* in world units */
+	int sprite;
+	unsigned int cols; /* frames in a row of the tileset */
+	Chunk **chunks; /* `cw * ch' chunk pointers per layer */
+	uint8_t *dirty; /* chunks changed since they were last drawn */
+	int ndirty, stale; /* stale if the whole map needs redrawing */
+	unsigned long id; /* key of the map in the cache of the renderer */
+	struct {
+		int sprite;
+		unsigned int cols;
+		Chunk **chunks;
+	} shown; /* copies drawn from, touched only when frames are replayed */
+	uint8_t solid[NTILES / 8];
+};
+
+static Chunk * tilemap_chunk(const Tilemap *, size_t, size_t, size_t);
+static void tilemap_update(void *, const void *, size_t);
+static void tilemap_draw(Gc *, int, int, int, int, int, void *);
+
+static unsigned long last_id;
+
+
+/**
+ * Create an empty `w' by `h' tiles map of `nlayers' layers
+ * Tiles are `tilew' by `tileh' world units large
+ */
+Tilemap *
+tilemap_create(size_t w, size_t h, size_t nlayers, int tilew, int tileh)
+{
+	Tilemap *tm;
+
+	if (!w || !h || !nlayers || tilew <= 0 || tileh <= 0) {
+		LOG_ERROR("invalid tilemap %zux%zux%zu of %dx%d tiles", w, h, nlayers, tilew, tileh);
+		return NULL;
+	}
+	tm = calloc(sizeof(Tilemap), 1);
+	if (!tm) {
+		LOG_ERROR("failed allocating a tilemap");
+		return NULL;
+	}
+	tm->w = w;
+	tm->h = h;
+	tm->nlayers = nlayers;
+	tm->cw = (w + TILE_CHUNK - 1) / TILE_CHUNK;
+	tm->ch = (h + TILE_CHUNK - 1) / TILE_CHUNK;
+	tm->tilew = tilew;
+	tm->tileh = tileh;
+	tm->sprite = -1;
+	tm->cols = 1;
+	tm->chunks = calloc(sizeof(Chunk *), tm->cw * tm->ch * nlayers);
+	tm->dirty = calloc(1, tm->cw * tm->ch * nlayers);
+	tm->shown.chunks = calloc(sizeof(Chunk *), tm->cw * tm->ch * nlayers);
+	if (!tm->chunks || !tm->dirty || !tm->shown.chunks) {
+		LOG_ERROR("failed allocating chunks of a %zux%zu tilemap", w, h);
+		free(tm->chunks);
+		free(tm->dirty);
+		free(tm->shown.chunks);
+		free(tm);
+		return NULL;
+	}
+	tm->shown.sprite = -1;
+	tm->id = ++last_id;
+	tm->stale = 1;
+	LOG_DEBUG("created %zux%zu tilemap of %zu layers", w, h, nlayers);
+
+	return tm;
+}
+
+/**
+ * Destroy the map once frames recorded with it were replayed
+ */
+void
+tilemap_destroy(Tilemap *tm)
+{
+	size_t i;
+
+	for (i = 0; i < tm->cw * tm->ch * tm->nlayers; ++i) {
+		free(tm->chunks[i]);
+		free(tm->shown.chunks[i]);
+	}
+	free(tm->chunks);
+	free(tm->shown.chunks);
+	free(tm->dirty);
+	free(tm);
+}
+
+/**
+ * Draw tiles with frames of `sprite', laid out in rows of `cols' frames
+ */
+void
+tilemap_set_tileset(Tilemap *tm, int sprite, unsigned int cols)
+{
+	tm->sprite = sprite;
+	tm->cols = cols ? cols : 1;
+	tm->stale = 1;
+}
+
+int
+tilemap_set(Tilemap *tm, size_t layer, size_t x, size_t y, uint16_t tile)
+{
+	Chunk **ch;
+	size_t i;
+
+	if (layer >= tm->nlayers || x >= tm->w || y >= tm->h) {
+		LOG_WARNING("tile %zux%zu of layer %zu is out of the map", x, y, layer);
+		return 0;
+	}
+	i = (layer * tm->ch + y / TILE_CHUNK) * tm->cw + x / TILE_CHUNK;
+	ch = &tm->chunks[i];
+	if (!*ch) {
+		if (tile == TILE_EMPTY)
+			return 1;
+		*ch = calloc(sizeof(Chunk), 1);
+		if (!*ch) {
+			LOG_ERROR("failed allocating a chunk of tiles");
+			return 0;
+		}
+	}
+	if ((**ch)[y % TILE_CHUNK * TILE_CHUNK + x % TILE_CHUNK] == tile)
+		return 1;
+	(**ch)[y % TILE_CHUNK * TILE_CHUNK + x % TILE_CHUNK] = tile;
+	if (!tm->dirty[i]) {
+		tm->dirty[i] = 1;
+		++tm->ndirty;
+	}
+
+	return 1;
+}
+
+uint16_t
+tilemap_get(const Tilemap *tm, size_t layer, size_t x, size_t y)
+{
+	Chunk *ch;
+
+	if (layer >= tm->nlayers || x >= tm->w || y >= tm->h)
+		return TILE_EMPTY;
+	ch = tilemap_chunk(tm, layer, x / TILE_CHUNK, y / TILE_CHUNK);
+	return ch ? (*ch)[y % TILE_CHUNK * TILE_CHUNK + x % TILE_CHUNK] : TILE_EMPTY;
+}
+
+/**
+ * Mark tiles of index `tile' as blocking movement
+ */
+void
+tilemap_set_solid(Tilemap *tm, uint16_t tile, int solid)
+{
+	if (solid)
+		tm->solid[tile / 8] |= 1 << tile % 8;
+	else
+		tm->solid[tile / 8] &= ~(1 << tile % 8);
+}
+
+/**
+ * Check whether a box given in world units overlaps a solid tile on any
+ * of the layers
+ */
+int
+tilemap_collide(const Tilemap *tm, int x, int y, int w, int h)
+{
+	size_t l, tx, ty, x0, y0, x1, y1;
+	uint16_t t;
+
+	if (w <= 0 || h <= 0 || x + w <= 0 || y + h <= 0)
+		return 0;
+	x0 = x > 0 ? (size_t)x / tm->tilew : 0;
+	y0 = y > 0 ? (size_t)y / tm->tileh : 0;
+	x1 = (size_t)(x + w - 1) / tm->tilew;
+	y1 = (size_t)(y + h - 1) / tm->tileh;
+	if (x0 >= tm->w || y0 >= tm->h)
+		return 0;
+	x1 = x1 < tm->w ? x1 : tm->w - 1;
+	y1 = y1 < tm->h ? y1 : tm->h - 1;
+	for (l = 0; l < tm->nlayers; ++l) {
+		for (ty = y0; ty <= y1; ++ty) {
+			for (tx = x0; tx <= x1; ++tx) {
+				t = tilemap_get(tm, l, tx, ty);
+				if (tm->solid[t / 8] & 1 << t % 8)
+					return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Record drawing of all the layers in view of the camera, lowest layer
+ * first; layer index is used as z position
+ * Chunks changed since the last call are copied into the list, so the
+ * map may change as soon as this returns
+ */
+void
+tilemap_render(Tilemap *tm, CmdList *cl)
+{
+	TileUpdate u;
+	size_t i, l, cx, cy;
+	int sw, sh, stale;
+
+	if (tm->sprite < 0)
+		return;
+	cmd_sprite_size(cl, tm->sprite, &sw, &sh);
+	u.sprite = tm->sprite;
+	u.cols = tm->cols;
+	stale = tm->stale;
+	if (stale) {
+		u.chunk = SIZE_MAX;
+		cmd_update(cl, tilemap_update, tm, &u, offsetof(TileUpdate, tiles));
+		for (l = 0; l < tm->nlayers; ++l)
+			cmd_invalidate_cache(cl, tm->id, l, INT_MIN, INT_MIN, INT_MAX, INT_MAX);
+		/* copy every chunk over again */
+		for (i = 0; i < tm->cw * tm->ch * tm->nlayers; ++i) {
+			if (tm->chunks[i] && !tm->dirty[i]) {
+				tm->dirty[i] = 1;
+				++tm->ndirty;
+			}
+		}
+		tm->stale = 0;
+	}
+	for (l = 0; tm->ndirty && l < tm->nlayers; ++l) {
+		for (cy = 0; cy < tm->ch; ++cy) {
+			for (cx = 0; cx < tm->cw; ++cx) {
+				i = (l * tm->ch + cy) * tm->cw + cx;
+				if (!tm->dirty[i])
+					continue;
+				u.chunk = i;
+				memcpy(u.tiles, *tm->chunks[i], sizeof(Chunk));
+				cmd_update(cl, tilemap_update, tm, &u, sizeof(u));
+				/* sprites of tiles reach past the chunk */
+				if (!stale)
+					cmd_invalidate_cache(cl, tm->id, l,
+						(long)cx * TILE_CHUNK * tm->tilew / 100 - sw,
+						(long)cy * TILE_CHUNK * tm->tileh / 100 - sh,
+						(long)(cx + 1) * TILE_CHUNK * tm->tilew / 100 + sw,
+						(long)(cy + 1) * TILE_CHUNK * tm->tileh / 100 + sh);
+				tm->dirty[i] = 0;
+				--tm->ndirty;
+			}
+		}
+	}
+	for (l = 0; l < tm->nlayers; ++l)
+		cmd_draw_cached(cl, tm->id, l, tilemap_draw, tm);
+}
+
+static Chunk *
+tilemap_chunk(const Tilemap *tm, size_t layer, size_t cx, size_t cy)
+{
+	return tm->chunks[(layer * tm->ch + cy) * tm->cw + cx];
+}
+
+/**
+ * Bring the copies drawn from up to date, where the frames are replayed
+ */
+static void
+tilemap_update(void *ctx, const void *data, size_t len)
+{
+	Tilemap *tm;
+	const TileUpdate *u;
+	Chunk **ch;
+
+	tm = ctx;
+	u = data;
+	tm->shown.sprite = u->sprite;
+	tm->shown.cols = u->cols;
+	if (u->chunk == SIZE_MAX)
+		return;
+	ch = &tm->shown.chunks[u->chunk];
+	if (!*ch && !(*ch = malloc(sizeof(Chunk)))) {
+		LOG_ERROR("failed allocating a chunk of tiles");
+		return;
+	}
+	memcpy(*ch, u->tiles, sizeof(Chunk));
+}
+
+/**
+ * Draw tiles of layer `l' whose sprites reach into the given area
+ */
+static void
+tilemap_draw(Gc *gc, int l, int x0, int y0, int x1, int y1, void *ctx)
+{
+	Tilemap *tm;
+	Chunk *ch;
+	size_t tx, ty;
+	int sw, sh;
+	long tx0, ty0, tx1, ty1;
+	uint16_t t;
+
+	tm = ctx;
+	gc_sprite_size(gc, tm->shown.sprite, &sw, &sh);
+	tx0 = ((long)x0 - sw) * 100 / tm->tilew;
+	ty0 = ((long)y0 - sh) * 100 / tm->tileh;
+	tx1 = ((long)x1 + sw) * 100 / tm->tilew + 1;
+	ty1 = ((long)y1 + sh) * 100 / tm->tileh + 1;
+	tx0 = tx0 > 0 ? tx0 : 0;
+	ty0 = ty0 > 0 ? ty0 : 0;
+	tx1 = tx1 < (long)tm->w ? tx1 : (long)tm->w;
+	ty1 = ty1 < (long)tm->h ? ty1 : (long)tm->h;
+	for (ty = ty0; (long)ty < ty1; ++ty) {
+		for (tx = tx0; (long)tx < tx1; ++tx) {
+			ch = tm->shown.chunks[(l * tm->ch + ty / TILE_CHUNK) * tm->cw + tx / TILE_CHUNK];
+			if (!ch || (t = (*ch)[ty % TILE_CHUNK * TILE_CHUNK + tx % TILE_CHUNK]) == TILE_EMPTY)
+				continue;
+			gc_batch_push(gc, tm->shown.sprite,
+				(int)tx * tm->tilew / 100, (int)ty * tm->tileh / 100, l,
+				(t - 1) % tm->shown.cols, (t - 1) / tm->shown.cols);
+		}
+	}
+}
@@ -0,0 +1,387 @@
+/**
+ * Copyright (c) 2026 Max Mruszczak <u at one u x dot o r g>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ *
+ * Pool of worker threads
+ */
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "worker.h"
+
+#define MAX_WORKERS 32
+#define QUEUE_INIT_CAP 256 /* initial capacity of a worker queue */
+
+typedef struct group {
+	size_t remaining;
+} Group;
+
+typedef struct job {
+	void (*fn)(void *);
+	void *ctx;
+	Group *group;
+} Job;
+
+/**
+ * Double-ended job queue of a worker
+ * The owner pushes and pops at the bottom, idle threads steal from the top
+ */
+typedef struct worker_arg {
+	struct workers *w;
+	size_t id;
+} WorkerArg;
+
+typedef struct deque {
+	pthread_mutex_t mtx;
+	Job *jobs;
+	size_t cap, top, bottom;
+} Deque;
+
+struct workers {
+	pthread_t threads[MAX_WORKERS];
+	WorkerArg args[MAX_WORKERS];
+	Deque q[MAX_WORKERS];
+	size_t n, next;
+	pthread_key_t self; /* 1-based index of the worker; unset elsewhere */
+	pthread_mutex_t mtx;
+	pthread_cond_t ready, done;
+	size_t nqueued, npending; /* jobs waiting in queues; queued or running */
+	int quit;
+}; /* type Workers */
+
+static int deque_grow(Deque *);
+static void push(Workers *, Job);
+static int take(Workers *, Job *);
+static void finish(Workers *, Job *);
+static void * worker_loop(void *);
+static size_t ncpus(void);
+
+
+/**
+ * Start a pool of `n' threads; one per online CPU if `n' is 0
+ */
+Workers *
+workers_create(size_t n)
+{
+	size_t i;
+	Workers *w;
+
+	if (!n)
+		n = ncpus();
+	if (n > MAX_WORKERS)
+		n = MAX_WORKERS;
+	w = calloc(sizeof(Workers), 1);
+	if (!w) {
+		LOG_PERROR("failed to allocate worker pool");
+		return NULL;
+	}
+	pthread_key_create(&w->self, NULL);
+	pthread_mutex_init(&w->mtx, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	pthread_cond_init(&w->done, NULL);
+	for (i = 0; i < MAX_WORKERS; ++i)
+		pthread_mutex_init(&w->q[i].mtx, NULL);
+	/* workers wait for the final thread count before touching the queues */
+	pthread_mutex_lock(&w->mtx);
+	for (i = 0; i < n; ++i) {
+		w->args[i].w = w;
+		w->args[i].id = i;
+		if (pthread_create(&w->threads[i], NULL, worker_loop, &w->args[i])) {
+			LOG_ERROR("failed to start worker thread #%zu", i);
+			break;
+		}
+	}
+	w->n = i;
+	pthread_mutex_unlock(&w->mtx);
+	LOG_DEBUG("started %zu worker threads", w->n);
+
+	return w;
+}
+
+void
+workers_destroy(Workers *w)
+{
+	size_t i;
+
+	workers_wait(w);
+	pthread_mutex_lock(&w->mtx);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->ready);
+	pthread_mutex_unlock(&w->mtx);
+	for (i = 0; i < w->n; ++i)
+		pthread_join(w->threads[i], NULL);
+	for (i = 0; i < MAX_WORKERS; ++i) {
+		pthread_mutex_destroy(&w->q[i].mtx);
+		free(w->q[i].jobs);
+	}
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->ready);
+	pthread_mutex_destroy(&w->mtx);
+	pthread_key_delete(w->self);
+	free(w);
+}
+
+/**
+ * Queue `fn(ctx)' to be run by one of the workers
+ * The job is run by the caller if there are no workers or the queue cannot
+ * grow
+ */
+void
+workers_submit(Workers *w, void (*fn)(void *), void *ctx)
+{
+	Job j;
+
+	j.fn = fn;
+	j.ctx = ctx;
+	j.group = NULL;
+	push(w, j);
+}
+
+/**
+ * Block until all the submitted jobs are finished, helping out with queued
+ * jobs in the meantime
+ */
+void
+workers_wait(Workers *w)
+{
+	Job j;
+
+	for (;;) {
+		if (take(w, &j)) {
+			j.fn(j.ctx);
+			finish(w, &j);
+			continue;
+		}
+		pthread_mutex_lock(&w->mtx);
+		if (!w->npending) {
+			pthread_mutex_unlock(&w->mtx);
+			return;
+		}
+		if (!w->nqueued)
+			pthread_cond_wait(&w->done, &w->mtx);
+		pthread_mutex_unlock(&w->mtx);
+	}
+}
+
+/**
+ * Run `fn' over `n' job contexts of `size' bytes each laid out in `jobs'
+ * and return once all of them are done
+ * Safe to be called from within a job; the calling thread runs queued jobs
+ * while waiting
+ */
+void
+workers_parallel_for(Workers *w, void (*fn)(void *), void *jobs, size_t size, size_t n)
+{
+	size_t i;
+	Group g;
+	Job j;
+
+	g.remaining = n;
+	j.fn = fn;
+	j.group = &g;
+	/* queue in reverse, so that the owner pops batches in order */
+	for (i = n; i--;) {
+		j.ctx = (char *)jobs + size * i;
+		push(w, j);
+	}
+	for (;;) {
+		if (take(w, &j)) {
+			j.fn(j.ctx);
+			finish(w, &j);
+			continue;
+		}
+		pthread_mutex_lock(&w->mtx);
+		if (!g.remaining) {
+			pthread_mutex_unlock(&w->mtx);
+			return;
+		}
+		if (!w->nqueued)
+			pthread_cond_wait(&w->done, &w->mtx);
+		pthread_mutex_unlock(&w->mtx);
+	}
+}
+
+size_t
+workers_count(const Workers *w)
+{
+	return w->n;
+}
+
+/**
+ * Double the capacity of a queue, keeping its jobs in place
+ */
+static int
+deque_grow(Deque *q)
+{
+	size_t cap, i;
+	Job *jobs;
+
+	cap = q->cap ? q->cap * 2 : QUEUE_INIT_CAP;
+	if (!(jobs = malloc(sizeof(Job) * cap)))
+		return -1;
+	for (i = q->top; i != q->bottom; ++i)
+		jobs[i % cap] = q->jobs[i % q->cap];
+	free(q->jobs);
+	q->jobs = jobs;
+	q->cap = cap;
+
+	return 0;
+}
+
+/**
+ * Put a job on the queue of the calling worker, or spread jobs submitted
+ * from outside of the pool over all the queues
+ * Queues grow as needed, so that large batches are all left to be stolen
+ * instead of being run by the submitting thread
+ */
+static void
+push(Workers *w, Job j)
+{
+	size_t id;
+	Deque *q;
+
+	pthread_mutex_lock(&w->mtx);
+	id = (uintptr_t)pthread_getspecific(w->self);
+	id = id ? id - 1 : w->next++ % (w->n ? w->n : 1);
+	++w->npending;
+	/* counted before it is published, so that taking it never makes the
+	 * count wrap around */
+	if (w->n)
+		++w->nqueued;
+	pthread_mutex_unlock(&w->mtx);
+	if (!w->n)
+		goto run;
+	q = &w->q[id];
+	pthread_mutex_lock(&q->mtx);
+	if (q->bottom - q->top == q->cap && deque_grow(q) < 0) {
+		pthread_mutex_unlock(&q->mtx);
+		LOG_WARNING("failed growing job queue #%zu; running the job in place", id);
+		pthread_mutex_lock(&w->mtx);
+		--w->nqueued;
+		pthread_mutex_unlock(&w->mtx);
+		goto run;
+	}
+	q->jobs[q->bottom++ % q->cap] = j;
+	pthread_mutex_unlock(&q->mtx);
+	pthread_mutex_lock(&w->mtx);
+	pthread_cond_signal(&w->ready);
+	pthread_cond_broadcast(&w->done); /* wake up threads waiting to help */
+	pthread_mutex_unlock(&w->mtx);
+	return;
+
+run:
+	j.fn(j.ctx);
+	finish(w, &j);
+}
+
+/**
+ * Pop the newest job of own queue or steal the oldest job of another one
+ */
+static int
+take(Workers *w, Job *j)
+{
+	size_t id, i, k;
+	Deque *q;
+
+	id = (uintptr_t)pthread_getspecific(w->self);
+	for (i = 0; i < w->n; ++i) {
+		k = id ? (id - 1 + i) % w->n : i;
+		q = &w->q[k];
+		pthread_mutex_lock(&q->mtx);
+		if (q->bottom == q->top) {
+			pthread_mutex_unlock(&q->mtx);
+			continue;
+		}
+		if (id && !i)
+			*j = q->jobs[--q->bottom % q->cap];
+		else
+			*j = q->jobs[q->top++ % q->cap];
+		pthread_mutex_unlock(&q->mtx);
+		pthread_mutex_lock(&w->mtx);
+		--w->nqueued;
+		pthread_mutex_unlock(&w->mtx);
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+finish(Workers *w, Job *j)
+{
+	pthread_mutex_lock(&w->mtx);
+	--w->npending;
+	if (j->group)
+		--j->group->remaining;
+	pthread_cond_broadcast(&w->done);
+	pthread_mutex_unlock(&w->mtx);
+}
+
+static void *
+worker_loop(void *arg)
+{
+	Workers *w;
+	Job j;
+
+	w = ((WorkerArg *)arg)->w;
+	pthread_setspecific(w->self, (void *)(uintptr_t)(((WorkerArg *)arg)->id + 1));
+	pthread_mutex_lock(&w->mtx);
+	pthread_mutex_unlock(&w->mtx);
+	for (;;) {
+		if (take(w, &j)) {
+			j.fn(j.ctx);
+			finish(w, &j);
+			continue;
+		}
+		pthread_mutex_lock(&w->mtx);
+		while (!w->nqueued && !w->quit)
+			pthread_cond_wait(&w->ready, &w->mtx);
+		if (w->quit) {
+			pthread_mutex_unlock(&w->mtx);
+			break;
+		}
+		pthread_mutex_unlock(&w->mtx);
+	}
+
+	return NULL;
+}
+
+static size_t
+ncpus(void)
+{
+	long n;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	n = 1;
+#endif /* _SC_NPROCESSORS_ONLN */
+	return n > 0 ? n : 1;
+}
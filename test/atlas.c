@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/log.h"
+#include "../src/atlas.h"
+
+#define SIZE 512
+#define NRECTS 2000
+
+static unsigned char used[SIZE][SIZE];
+
+int
+main(void)
+{
+	Atlas *a;
+	int i, w, h, x, y, u, v, area, packed;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	/* same sized rectangles fill the area completely */
+	a = atlas_create(SIZE, SIZE);
+	assert(a);
+	for (i = 0; i < (SIZE / 64) * (SIZE / 64); ++i)
+		assert(atlas_pack(a, 64, 64, &x, &y));
+	assert(!atlas_pack(a, 1, 1, &x, &y));
+	atlas_destroy(a);
+
+	/* rectangles never overlap nor leave the area */
+	a = atlas_create(SIZE, SIZE);
+	srand(1);
+	area = packed = 0;
+	for (i = 0; i < NRECTS; ++i) {
+		w = 1 + rand() % 64;
+		h = 1 + rand() % 64;
+		if (!atlas_pack(a, w, h, &x, &y))
+			continue;
+		++packed;
+		area += w * h;
+		assert(x >= 0 && y >= 0 && x + w <= SIZE && y + h <= SIZE);
+		for (v = y; v < y + h; ++v)
+			for (u = x; u < x + w; ++u)
+				assert(!used[v][u]++);
+	}
+	assert(!atlas_pack(a, SIZE + 1, 1, &x, &y));
+	LOG_INFO("packed %d rectangles covering %d%% of the atlas", packed, area * 100 / (SIZE * SIZE));
+	assert(area > SIZE * SIZE / 2);
+	atlas_destroy(a);
+
+	return 0;
+}
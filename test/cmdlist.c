@@ -0,0 +1,210 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/log.h"
+#include "../src/ff.h"
+#include "../src/render.h"
+#include "../src/cmdlist.h"
+#include "../src/rthread.h"
+#include "../src/tilemap.h"
+
+#define DUMP "cmdlist.test.ff"
+#define MAP 16
+
+static Image *snap(Gc *);
+static int same(const Image *, Image *);
+static void draw(Gc *, int, const char *);
+static void record(CmdList *, int, const char *);
+static void fill(Gc *, int, int, int, int, int, void *);
+static void paint(Tilemap *, int);
+
+static int sprite;
+static int nfills;
+
+static Image *
+snap(Gc *gc)
+{
+	Image *img;
+
+	assert(!gc_dump(gc, DUMP));
+	assert((img = ff_load(DUMP, IMAGE_RGBA8)));
+	remove(DUMP);
+	return img;
+}
+
+static int
+same(const Image *a, Image *b)
+{
+	int r;
+
+	r = a->siz == b->siz && !memcmp(a->d, b->d, a->siz);
+	free(b->d);
+	free(b);
+	return r;
+}
+
+static void
+draw(Gc *gc, int n, const char *s)
+{
+	Camera cam;
+	int i;
+
+	cam.x = 10;
+	cam.y = -20;
+	cam.zoom = 2.f;
+	gc_clear(gc);
+	gc_set_camera(gc, &cam);
+	gc_draw_cached(gc, 1, 0, fill, NULL);
+	for (i = 0; i < n; ++i)
+		gc_queue_push(gc, sprite, 30 + 7 * i, 40 + 3 * i, i % 3, i % 2, 0);
+	gc_queue_submit(gc);
+	gc_set_camera(gc, NULL);
+	gc_print(gc, sprite, 100, 100, 15, s, 0);
+}
+
+static void
+record(CmdList *l, int n, const char *s)
+{
+	Camera cam;
+	int i;
+
+	cam.x = 10;
+	cam.y = -20;
+	cam.zoom = 2.f;
+	cmd_clear(l);
+	cmd_set_camera(l, &cam);
+	cmd_draw_cached(l, 1, 0, fill, NULL);
+	for (i = 0; i < n; ++i)
+		cmd_queue_push(l, sprite, 30 + 7 * i, 40 + 3 * i, i % 3, i % 2, 0);
+	cmd_queue_submit(l);
+	cmd_set_camera(l, NULL);
+	cmd_print(l, sprite, 100, 100, 15, s, 0);
+}
+
+static void
+paint(Tilemap *tm, int n)
+{
+	size_t x, y;
+
+	for (y = 0; y < MAP; ++y)
+		for (x = 0; x < MAP; ++x)
+			assert(tilemap_set(tm, 0, x, y, 1 + (x + y + n) % 2));
+}
+
+static void
+fill(Gc *gc, int z, int x0, int y0, int x1, int y1, void *ctx)
+{
+	++nfills;
+	gc_batch_push(gc, sprite, 20, 20, z, 0, 0);
+}
+
+int
+main(void)
+{
+	Gc *gc;
+	Image sheet, *ref;
+	float d[8 * 2 * 4];
+	char text[] = "! !!";
+	CmdList *l, *next;
+	RenderThread *rt;
+	Tilemap *tm;
+	int i, x0, y0, x1, y1;
+	Camera cam;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	for (i = 0; i < 8 * 2; ++i) {
+		d[i * 4] = i % 8 < 4;
+		d[i * 4 + 1] = (float)(i % 8) / 8.f;
+		d[i * 4 + 2] = i % 8 >= 4;
+		d[i * 4 + 3] = i % 8 < 4 ? 1.f : .5f;
+	}
+	sheet.w = 8;
+	sheet.h = 2;
+	sheet.siz = 8 * 2 * 4;
+	sheet.fmt = IMAGE_FLOAT;
+	sheet.d = d;
+	assert((gc = gc_new()));
+	assert(!gc_init(gc, GC_PROFILE_LEGACY));
+	assert((sprite = gc_create_sprite(gc, &sheet, 4, 2)) >= 0);
+
+	draw(gc, 100, text);
+	ref = snap(gc);
+	assert(nfills == 1);
+
+	/* replaying a list draws what the calls it recorded would */
+	assert((l = cmdlist_create(gc)));
+	record(l, 100, text);
+	assert(cmdlist_size(l) == 106);
+	assert(nfills == 1);
+	/* printed text is copied */
+	text[0] = 'x';
+	cmdlist_replay(l, gc);
+	assert(nfills == 2);
+	assert(same(ref, snap(gc)));
+	text[0] = '!';
+
+	/* queries go by the camera recorded last */
+	cmdlist_reset(l);
+	assert(!cmdlist_size(l));
+	cam.x = 1000;
+	cam.y = 0;
+	cam.zoom = 1.f;
+	cmd_set_camera(l, &cam);
+	cmd_get_view(l, &x0, &y0, &x1, &y1);
+	assert(x0 == 1000 && y0 == 0 && x1 == 1000 + 2 * 640 && y1 == 2 * 480);
+	assert(!cmd_visible(l, sprite, 30, 40));
+	assert(cmd_visible(l, sprite, 997, 40));
+	cmd_set_camera(l, NULL);
+	assert(cmd_visible(l, sprite, 30, 40));
+	cmdlist_destroy(l);
+
+	/* frames recorded for the render thread are presented in turn; the
+	 * last one is presented before the thread stops */
+	assert((rt = rthread_create(gc)));
+	for (i = 0; i < 10; ++i) {
+		l = rthread_list(rt);
+		record(l, 10 * i, text);
+		rthread_submit(rt);
+		next = rthread_list(rt);
+		assert(next != l && !cmdlist_size(next));
+	}
+	record(rthread_list(rt), 100, text);
+	rthread_submit(rt);
+	rthread_destroy(rt);
+	assert(nfills == 13);
+	assert(same(ref, snap(gc)));
+	free(ref->d);
+	free(ref);
+
+	/* the map may change as soon as a frame is recorded; the render
+	 * thread draws it as it was then */
+	assert((tm = tilemap_create(MAP, MAP, 1, 400, 400)));
+	tilemap_set_tileset(tm, sprite, 2);
+	paint(tm, 0);
+	assert((l = cmdlist_create(gc)));
+	cmd_clear(l);
+	cmd_set_camera(l, NULL);
+	tilemap_render(tm, l);
+	cmdlist_replay(l, gc);
+	cmdlist_destroy(l);
+	ref = snap(gc);
+	assert((rt = rthread_create(gc)));
+	for (i = 0; i <= 50; ++i) {
+		l = rthread_list(rt);
+		cmd_clear(l);
+		cmd_set_camera(l, NULL);
+		tilemap_render(tm, l);
+		rthread_submit(rt);
+		paint(tm, i + 1);
+	}
+	rthread_destroy(rt);
+	assert(same(ref, snap(gc)));
+	tilemap_destroy(tm);
+
+	return 0;
+}
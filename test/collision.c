@@ -0,0 +1,101 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/log.h"
+#include "../src/collision.h"
+
+#define CELL 100
+#define NROW 50
+#define NPILE 5000
+
+enum {
+	LAYER_PLAYER = 1 << 0,
+	LAYER_WALL = 1 << 1,
+	LAYER_ITEM = 1 << 2
+};
+
+static int counts[3];
+static CollisionPair last;
+
+static void
+count(enum collision_event ev, const CollisionPair *pairs, size_t n, void *ctx)
+{
+	counts[ev == COLLISION_ENTER ? 0 : ev == COLLISION_STAY ? 1 : 2] += n;
+	last = pairs[n - 1];
+}
+
+int
+main(void)
+{
+	Collisions *c;
+	int i;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	c = collisions_create(CELL);
+	assert(c);
+	assert(collisions_handle(c, LAYER_PLAYER, LAYER_ITEM,
+		COLLISION_ENTER | COLLISION_STAY | COLLISION_EXIT, count, NULL) >= 0);
+
+	/* a row of touching walls does not report anything without a handler;
+	 * the item spans several cells, including negative ones */
+	for (i = 0; i < NROW; ++i)
+		collisions_add(c, 100 + i, i * 50 - 1000, 0, 50, 50, LAYER_WALL, LAYER_WALL);
+	collisions_add(c, 1, -150, -150, 300, 300, LAYER_ITEM, 0);
+	collisions_add(c, 2, -10, -10, 20, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[0] == 1 && counts[1] == 0 && counts[2] == 0);
+	/* pairs come with the box on the handler's layer first */
+	assert(last.first == 2 && last.second == 1);
+
+	collisions_add(c, 1, -150, -150, 300, 300, LAYER_ITEM, 0);
+	collisions_add(c, 2, 100, 100, 20, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[0] == 1 && counts[1] == 1 && counts[2] == 0);
+
+	/* touching edges do not overlap */
+	collisions_add(c, 1, -150, -150, 300, 300, LAYER_ITEM, 0);
+	collisions_add(c, 2, 150, 100, 20, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[0] == 1 && counts[1] == 1 && counts[2] == 1);
+
+	/* boxes gone between updates exit as well */
+	collisions_add(c, 2, 0, 0, 20, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_add(c, 3, 5, 5, 20, 20, LAYER_ITEM, 0);
+	collisions_update(c);
+	assert(counts[0] == 2);
+	collisions_update(c);
+	assert(counts[0] == 2 && counts[1] == 1 && counts[2] == 2);
+	assert(last.first == 2 && last.second == 3);
+
+	/* static boxes are only tested against the others */
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < NROW * NROW; ++i)
+		collisions_add_static(c, 1000 + i, i % NROW * 100, i / NROW * 100, 100, 100,
+			LAYER_ITEM, LAYER_ITEM);
+	collisions_add(c, 2, 150, 150, 200, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[0] == 3);
+	collisions_add(c, 2, 150, 150, 200, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[0] == 3 && counts[1] == 3);
+	collisions_clear_static(c);
+	collisions_add(c, 2, 150, 150, 200, 20, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[1] == 3 && counts[2] == 3);
+
+	/* boxes piled up on one spot still make a tree shallow enough to be
+	 * queried */
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < NPILE; ++i)
+		collisions_add_static(c, 10000 + i, 0, 0, 10, 10, LAYER_ITEM, 0);
+	collisions_add(c, 2, 5, 5, 10, 10, LAYER_PLAYER, LAYER_ITEM);
+	collisions_update(c);
+	assert(counts[0] == NPILE);
+	collisions_destroy(c);
+
+	return 0;
+}
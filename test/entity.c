@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -6,24 +7,218 @@
 #include "../src/dict.h"
 #include "../src/ff.h"
 #include "../src/render.h"
+#include "../src/audio.h"
 #include "../src/entity.h"
+#include "../src/worker.h"
+#include "../src/collision.h"
+
+#define NTILES 100000
+#define NBODIES 5000
+#define NTICKS 50
+#define NSPAWNS 100
+#define NMOVERS 2000
+#define CHUNK 256 /* entities per archetype chunk */
+
+static int spawned[NSPAWNS], spawned_text;
+
+static void spawn_on_collision(enum collision_event, const CollisionPair *, size_t, void *);
+
+static void simulate(Workers *, EntityInfo *);
+
+/**
+ * Spawn entities from within a tick; they stay dormant until it is over
+ */
+static void
+spawn_on_collision(enum collision_event ev, const CollisionPair *pairs, size_t n, void *ctx)
+{
+	EntityManager *emgr;
+	EntityInfo info;
+	int i;
+
+	emgr = ctx;
+	memset(&info, 0, sizeof(EntityInfo));
+	info.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_COLLIDER);
+	for (i = 0; i < NSPAWNS; ++i) {
+		info.x = i;
+		assert((spawned[i] = entity_spawn(emgr, info)) >= 0);
+		assert(!entity_valid(emgr, spawned[i]));
+	}
+	spawned_text = entity_spawn_text(emgr, 7, 10, 20, "text", 1);
+	assert(spawned_text >= 0 && !entity_valid(emgr, spawned_text));
+}
+
+/**
+ * Tick a fixed scene of moving bodies and report where they end up
+ */
+static void
+simulate(Workers *workers, EntityInfo *out)
+{
+	GameState state;
+	EntityInfo info;
+	int ids[NBODIES], i;
+
+	memset(&state, 0, sizeof(GameState));
+	memset(&info, 0, sizeof(EntityInfo));
+	state.entity_manager = create_entity_manager();
+	state.workers = workers;
+	info.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_VEL | COMPONENT_ACC
+		| COMPONENT_SPRITE | COMPONENT_ANIM);
+	info.w = info.h = 3200;
+	for (i = 0; i < NBODIES; ++i) {
+		info.x = i * 37;
+		info.y = -i * 11;
+		info.vx = (i % 97) * 31 - 1500;
+		info.vy = (i % 89) * 29 - 1300;
+		assert((ids[i] = entity_spawn(state.entity_manager, info)) >= 0);
+	}
+	for (i = 0; i < NTICKS; ++i)
+		process_tick(&state);
+	for (i = 0; i < NBODIES; ++i)
+		assert(entity_get_info(state.entity_manager, ids[i], &out[i]));
+	destroy_entity_manager(state.entity_manager);
+}
 
 int
 main(void)
 {
 	GameState state;
-	EntityInfo info;
-	int entity;
+	EntityInfo info, out;
+	static EntityInfo serial[NBODIES], parallel[NBODIES];
+	int entity, player, stale, i, n;
+	int movers[NMOVERS];
+	Workers *workers;
+	EntityStats stats;
 
 	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
 	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
 
+	memset(&info, 0, sizeof(EntityInfo));
 	state.entity_manager = create_entity_manager();
 	entity = entity_spawn(state.entity_manager, info);
 	LOG_INFO("spawned entity #%d", entity);
 	entity = entity_spawn(state.entity_manager, info);
 	LOG_INFO("spawned entity #%d", entity);
+
+	/* no fixed ceiling on the amount of entities */
+	info.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_ZPOS | COMPONENT_SPRITE);
+	info.w = info.h = 6400;
+	for (i = 0; i < NTILES; ++i) {
+		info.x = i;
+		info.y = -i;
+		assert(entity_spawn(state.entity_manager, info) >= 0);
+	}
+	assert(entity_get_info(state.entity_manager, NTILES, &out));
+	assert(out.x == NTILES - 2 && out.y == 2 - NTILES && out.h == 6400);
+
+	/* data survives moving between archetypes */
+	info.components |= COMPONENT_VEL;
+	info.x = 123;
+	info.y = 456;
+	player = entity_spawn(state.entity_manager, info);
+	assert(entity_set_components(state.entity_manager, player,
+		COMPONENT_POS | COMPONENT_DIM));
+	assert(entity_get_info(state.entity_manager, player, &out));
+	assert(out.components == (COMPONENT_POS | COMPONENT_DIM));
+	assert(out.x == 123 && out.y == 456 && out.z == 0);
+
+	/* removing a row keeps the rest of the archetype intact */
+	entity_delete(state.entity_manager, 2);
+	assert(!entity_get_info(state.entity_manager, 2, &out));
+	assert(entity_get_info(state.entity_manager, NTILES + 1, &out));
+	assert(out.x == NTILES - 1);
+
+	/* sparse components are added and dropped without losing other data */
+	entity = entity_spawn_text(state.entity_manager, 0, 100, 200, "text", 1);
+	assert(entity_get_info(state.entity_manager, entity, &out));
+	assert(out.components == (COMPONENT_POS | COMPONENT_TEXT | COMPONENT_ANIM));
+	assert(entity_set_components(state.entity_manager, entity, COMPONENT_POS | COMPONENT_TEXT));
+	assert(entity_get_info(state.entity_manager, entity, &out));
+	assert(out.components == (COMPONENT_POS | COMPONENT_TEXT));
+	assert(out.x == 100 && out.y == 200);
+
+	/* handles of deleted entities are not aliased by reused slots */
+	stale = entity;
+	entity_delete(state.entity_manager, stale);
+	assert(!entity_valid(state.entity_manager, stale));
+	entity = entity_spawn(state.entity_manager, info);
+	assert(entity != stale);
+	assert(entity_valid(state.entity_manager, entity));
+	assert(!entity_valid(state.entity_manager, stale));
+	assert(!entity_get_info(state.entity_manager, stale, &out));
+	entity_delete(state.entity_manager, stale);
+	assert(entity_valid(state.entity_manager, entity));
 	destroy_entity_manager(state.entity_manager);
 
+	/* spawns from collision handlers are applied after the tick, into
+	 * freed slots first and then past the end of the entity table */
+	memset(&state, 0, sizeof(GameState));
+	memset(&info, 0, sizeof(EntityInfo));
+	state.entity_manager = create_entity_manager();
+	assert((state.collisions = collisions_create(6400)));
+	assert(collisions_handle(state.collisions, 1, 2, COLLISION_ENTER,
+		spawn_on_collision, state.entity_manager) >= 0);
+	info.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_COLLIDER);
+	info.w = info.h = 100;
+	for (i = 0; i < 1000; ++i) {
+		info.x = i * 1000;
+		entity = entity_spawn(state.entity_manager, info);
+	}
+	entity_delete(state.entity_manager, entity);
+	info.x = info.y = 0;
+	info.layer = 1;
+	info.mask = 2;
+	entity_spawn(state.entity_manager, info);
+	info.layer = 2;
+	info.mask = 0;
+	entity_spawn(state.entity_manager, info);
+	process_tick(&state);
+	assert(spawned[0] != entity && !entity_valid(state.entity_manager, entity));
+	for (i = 0; i < NSPAWNS; ++i) {
+		assert(entity_get_info(state.entity_manager, spawned[i], &out));
+		assert(out.x == i && out.components == info.components);
+	}
+	assert(entity_get_info(state.entity_manager, spawned_text, &out));
+	assert(out.components == (COMPONENT_POS | COMPONENT_TEXT | COMPONENT_ANIM));
+	assert(out.x == 10 && out.y == 20 && out.sprite == 7 && !strcmp(out.txt, "text"));
+	collisions_destroy(state.collisions);
+	destroy_entity_manager(state.entity_manager);
+
+	/* pooled components are walked in the order of the chunks, a chunk at
+	 * a time, no matter the order they were added in */
+	memset(&state, 0, sizeof(GameState));
+	memset(&info, 0, sizeof(EntityInfo));
+	state.entity_manager = create_entity_manager();
+	info.components = (COMPONENT_DIM | COMPONENT_POS | COMPONENT_SPRITE);
+	for (i = 0; i < NTILES / 10; ++i)
+		assert(entity_spawn(state.entity_manager, info) >= 0);
+	info.components |= (COMPONENT_VEL | COMPONENT_ACC | COMPONENT_ANIM);
+	info.vx = 1000;
+	for (i = 0; i < NMOVERS; ++i)
+		assert((movers[i] = entity_spawn(state.entity_manager, info)) >= 0);
+	for (i = 0; i < NMOVERS; i += 7) {
+		assert(entity_set_components(state.entity_manager, movers[i],
+			info.components & ~COMPONENT_ANIM));
+		assert(entity_set_components(state.entity_manager, movers[i], info.components));
+	}
+	for (i = 1, n = NMOVERS; i < NMOVERS; i += 100, --n)
+		entity_delete(state.entity_manager, movers[i]);
+	process_tick(&state);
+	entity_get_stats(state.entity_manager, &stats);
+	/* displaced and animated */
+	assert(stats.rows == 2 * (unsigned long)n);
+	assert(stats.calls == 2 * (unsigned long)((n + CHUNK - 1) / CHUNK));
+	destroy_entity_manager(state.entity_manager);
+
+	/* systems split across workers end up where a single thread does */
+	simulate(NULL, serial);
+	assert(serial[1].x != 37 && serial[1].vx != 31 - 1500);
+	assert((workers = workers_create(4)));
+	simulate(workers, parallel);
+	workers_destroy(workers);
+	for (i = 0; i < NBODIES; ++i) {
+		assert(serial[i].x == parallel[i].x && serial[i].y == parallel[i].y);
+		assert(serial[i].vx == parallel[i].vx && serial[i].vy == parallel[i].vy);
+	}
+
 	return 0;
 }
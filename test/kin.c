@@ -0,0 +1,117 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/log.h"
+#include "../src/kin.h"
+
+#define NBODIES 1001
+#define NSTEPS 100
+#define MAX_OFFS 4 /* ints to shift arrays by, to break vector alignment */
+#define TICK (1. / 120)
+
+static int pos[NBODIES * 2 + MAX_OFFS], prev[NBODIES * 2 + MAX_OFFS];
+static int vel[NBODIES * 2 + MAX_OFFS], acc[NBODIES * 2 + MAX_OFFS];
+static int ref_pos[NBODIES * 2], ref_prev[NBODIES * 2], ref_vel[NBODIES * 2], ref_acc[NBODIES * 2];
+
+static void check(int);
+static double terminal(double);
+
+/**
+ * Step bodies stored `offs' ints into the arrays, with body counts leaving
+ * all kinds of tails, and compare them with the plain C expressions
+ */
+static void
+check(int offs)
+{
+	KinCoefs co;
+	float dx, dy;
+	size_t n;
+	int i, j;
+
+	kin_get_coefs(&co);
+	srand(1);
+	memset(acc, 0, sizeof(acc));
+	memset(ref_acc, 0, sizeof(ref_acc));
+	memset(prev, 0, sizeof(prev));
+	memset(ref_prev, 0, sizeof(ref_prev));
+	for (i = 0; i < NBODIES * 2; ++i) {
+		ref_pos[i] = pos[offs + i] = rand() % 200001 - 100000;
+		ref_vel[i] = vel[offs + i] = rand() % 20001 - 10000;
+	}
+	for (j = 0; j < NSTEPS; ++j) {
+		dx = (j % 3 - 1) * .7f;
+		dy = (j % 5 - 2) * .35f;
+		n = NBODIES - j % 17;
+		kin_accelerate(acc + offs, vel + offs, n, dx, dy);
+		kin_displace(pos + offs, prev + offs, vel + offs, acc + offs, n);
+		for (i = 0; i < (int)n * 2; i += 2) {
+			ref_acc[i] = co.accel * dx - (int)(ref_vel[i] * co.drag);
+			ref_acc[i+1] = co.accel * dy - (int)(ref_vel[i+1] * co.drag);
+		}
+		for (i = 0; i < (int)n * 2; ++i) {
+			ref_vel[i] = (ref_vel[i] + ref_acc[i]) * co.damping;
+			ref_prev[i] = ref_pos[i];
+			ref_pos[i] += ref_vel[i];
+		}
+	}
+	assert(!memcmp(acc + offs, ref_acc, sizeof(ref_acc)));
+	assert(!memcmp(vel + offs, ref_vel, sizeof(ref_vel)));
+	assert(!memcmp(pos + offs, ref_pos, sizeof(ref_pos)));
+	assert(!memcmp(prev + offs, ref_prev, sizeof(ref_prev)));
+}
+
+/**
+ * Get speed per second a body pushed by full input settles at, with ticks
+ * `tick' seconds long
+ */
+static double
+terminal(double tick)
+{
+	int i, p[2], q[2], v[2], a[2];
+
+	kin_init(tick);
+	p[0] = p[1] = v[0] = v[1] = 0;
+	for (i = 0; i < 1. / tick; ++i) {
+		kin_accelerate(a, v, 1, 1.f, 0.f);
+		kin_displace(p, q, v, a, 1);
+	}
+	return v[0] / tick;
+}
+
+int
+main(void)
+{
+	static const char *names[] = {"scalar", "SSE2", "AVX2"};
+	double v;
+	int k, offs;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	/* bodies move as fast whatever the tick rate, as long as ticks are
+	 * long enough for velocity not to be lost to truncation */
+	v = terminal(1. / 120);
+	LOG_INFO("terminal speed %.0f units a second", v);
+	assert(v > 42000. && v < 44000.);
+	assert(terminal(1. / 60) > v * .99 && terminal(1. / 60) < v * 1.01);
+	assert(terminal(1. / 30) > v * .99 && terminal(1. / 30) < v * 1.01);
+
+	kin_init(TICK);
+	/* every kernel set the CPU runs matches the plain C expressions bit
+	 * for bit, whatever the alignment */
+	for (k = KIN_SCALAR; k <= KIN_AVX2; ++k) {
+		if (!kin_use(k)) {
+			LOG_INFO("%s kernels not supported; skipped", names[k]);
+			continue;
+		}
+		for (offs = 0; offs < MAX_OFFS; ++offs)
+			check(offs);
+		LOG_INFO("%s kernels match", names[k]);
+	}
+	kin_init(TICK);
+	check(0);
+
+	return 0;
+}
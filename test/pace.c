@@ -0,0 +1,59 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../src/log.h"
+#include "../src/pace.h"
+
+int
+main(void)
+{
+	Pacer *p;
+	double t0, t;
+	unsigned long n;
+	int i;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	/* sleeps never end early; upper bounds throughout only catch gross
+	 * errors, as loaded machines oversleep by a lot */
+	t0 = pace_clock();
+	pace_sleep_until(t0 + .02);
+	t = pace_clock();
+	assert(t >= t0 + .02 && t < t0 + .2);
+
+	/* ticks are taken out of elapsed time, leaving the remainder */
+	t0 = pace_clock();
+	assert((p = pace_create(.01, 0)));
+	pace_sleep_until(t0 + .055);
+	n = pace_ticks(p);
+	assert(n >= 5 && n <= 25);
+	assert(pace_alpha(p) >= 0. && pace_alpha(p) < 1.);
+	assert(pace_ticks(p) == 0);
+
+	/* a stall is caught up only in part */
+	pace_sleep_until(pace_clock() + .4);
+	n = pace_ticks(p);
+	assert(n >= 24 && n <= 25);
+	pace_destroy(p);
+
+	/* frames keep to the target rate */
+	assert((p = pace_create(.01, 50)));
+	t0 = pace_clock();
+	for (i = 0; i < 5; ++i)
+		pace_wait(p);
+	t = pace_clock() - t0;
+	assert(t >= .09 && t < .5);
+
+	/* and a late one does not make the next ones hurry */
+	pace_sleep_until(pace_clock() + .1);
+	t0 = pace_clock();
+	pace_wait(p);
+	assert(pace_clock() - t0 < .015);
+	pace_wait(p);
+	assert(pace_clock() - t0 >= .019);
+	pace_destroy(p);
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/log.h"
+#include "../src/rqueue.h"
+
+#define NCMDS 10000
+
+int
+main(void)
+{
+	RenderQueue *q;
+	RenderCmd cmd;
+	const RenderCmd *a, *b;
+	uint64_t ka, kb;
+	size_t i;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	/* layers come first, then depth, then texture */
+	assert(rqueue_key(0, 1000, 7) < rqueue_key(1, -1000, 0));
+	assert(rqueue_key(1, -5, 7) < rqueue_key(1, 3, 0));
+	assert(rqueue_key(1, 3, 0) < rqueue_key(1, 3, 1));
+
+	q = rqueue_create();
+	assert(q);
+	assert(rqueue_sort(q) == 0);
+
+	/* commands come out ordered by key; equal keys keep their order */
+	srand(1);
+	for (i = 0; i < NCMDS; ++i) {
+		cmd.sprite = rand() % 4;
+		cmd.x = i;
+		cmd.y = rand() % 512 - 256;
+		cmd.z = rand() % 3;
+		cmd.ox = cmd.oy = 0;
+		assert(rqueue_push(q, rqueue_key(cmd.z, cmd.y, cmd.sprite), &cmd));
+	}
+	assert(rqueue_sort(q) == NCMDS);
+	for (i = 1; i < NCMDS; ++i) {
+		a = rqueue_get(q, i - 1);
+		b = rqueue_get(q, i);
+		ka = rqueue_key(a->z, a->y, a->sprite);
+		kb = rqueue_key(b->z, b->y, b->sprite);
+		assert(ka < kb || (ka == kb && a->x < b->x));
+	}
+
+	/* the queue is reusable after clearing */
+	rqueue_clear(q);
+	cmd.x = 1;
+	assert(rqueue_push(q, rqueue_key(2, 0, 0), &cmd));
+	cmd.x = 2;
+	assert(rqueue_push(q, rqueue_key(1, 0, 0), &cmd));
+	assert(rqueue_sort(q) == 2);
+	assert(rqueue_get(q, 0)->x == 2 && rqueue_get(q, 1)->x == 1);
+	rqueue_destroy(q);
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/log.h"
+#include "../src/ff.h"
+#include "../src/render.h"
+
+#define DUMP "softrender.test.ff"
+#define PIXELS "softrender.pixels.ff"
+
+static Image *snap(Gc *, enum image_format);
+static void pixel(const Image *, int, int, int *);
+
+static Image *
+snap(Gc *gc, enum image_format fmt)
+{
+	Image *img;
+
+	assert(!gc_dump(gc, DUMP));
+	assert((img = ff_load(DUMP, fmt)));
+	remove(DUMP);
+	return img;
+}
+
+static void
+pixel(const Image *img, int x, int y, int *px)
+{
+	int i;
+
+	for (i = 0; i < 4; ++i)
+		px[i] = ((uint8_t *)img->d)[(y * img->w + x) * 4 + i];
+}
+
+int
+main(void)
+{
+	Gc *gc;
+	Image sheet, *img, *wide, *flt;
+	float d[8 * 2 * 4];
+	int sprite, opaque, other, px[4], ref[4], i;
+	Camera cam;
+	FILE *f;
+	static const unsigned char ff[] = {
+		'f', 'a', 'r', 'b', 'f', 'e', 'l', 'd', 0, 0, 0, 1, 0, 0, 0, 1,
+		0xff, 0xff, 0x00, 0x81, 0xff, 0x00, 0x80, 0x00
+	};
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	/* 16 bit channels are rounded to the nearest 8 bit value */
+	assert((f = fopen(PIXELS, "wb")));
+	assert(fwrite(ff, 1, sizeof(ff), f) == sizeof(ff));
+	fclose(f);
+	assert((img = ff_load(PIXELS, IMAGE_RGBA8)));
+	pixel(img, 0, 0, px);
+	assert(px[0] == 255 && px[1] == 1 && px[2] == 254 && px[3] == 128);
+	free(img->d);
+	free(img);
+	assert(!ff_load(PIXELS, (enum image_format)42));
+	remove(PIXELS);
+
+	/* two 4x2 frames: opaque red and half transparent blue */
+	for (i = 0; i < 8 * 2; ++i) {
+		d[i * 4] = i % 8 < 4;
+		d[i * 4 + 1] = 0.f;
+		d[i * 4 + 2] = i % 8 >= 4;
+		d[i * 4 + 3] = i % 8 < 4 ? 1.f : .5f;
+	}
+	sheet.w = 8;
+	sheet.h = 2;
+	sheet.siz = 8 * 2 * 4;
+	sheet.fmt = IMAGE_FLOAT;
+	sheet.d = d;
+	assert((gc = gc_new()));
+	assert(!gc_init(gc, GC_PROFILE_LEGACY));
+	assert((sprite = gc_create_sprite(gc, &sheet, 4, 2)) >= 0);
+	assert(image_translucent(&sheet));
+	for (i = 0; i < 8 * 2; ++i)
+		d[i * 4 + 3] = 1.f;
+	assert(!image_translucent(&sheet));
+	assert((opaque = gc_create_sprite(gc, &sheet, 4, 2)) >= 0);
+	assert((other = gc_create_sprite(gc, &sheet, 4, 2)) >= 0);
+
+	/* frames cover their size in pixels around the centre, which sits at
+	 * half the drawing coordinates */
+	gc_clear(gc);
+	gc_draw(gc, sprite, 20, 20, 0, 0, 0);
+	img = snap(gc, IMAGE_RGBA8);
+	assert(img->w == 640 && img->h == 480);
+	pixel(img, 8, 9, px);
+	assert(px[0] == 255 && px[1] == 0 && px[2] == 0 && px[3] == 255);
+	pixel(img, 11, 10, px);
+	assert(px[0] == 255 && px[2] == 0);
+	pixel(img, 7, 9, px);
+	assert(px[0] == 255 && px[1] == 255 && px[2] == 255);
+	pixel(img, 12, 9, px);
+	assert(px[1] == 255);
+	pixel(img, 8, 11, px);
+	assert(px[1] == 255);
+
+	/* every format decodes the same pixels */
+	wide = snap(gc, IMAGE_RGBA16);
+	flt = snap(gc, IMAGE_FLOAT);
+	for (i = 0; i < (int)img->siz; ++i) {
+		assert(((uint16_t *)wide->d)[i] >> 8 == ((uint8_t *)img->d)[i]);
+		assert((int)(((float *)flt->d)[i] * 256.f) == ((uint8_t *)img->d)[i]);
+	}
+	assert(!image_translucent(img) && !image_translucent(wide) && !image_translucent(flt));
+	free(img->d);
+	free(img);
+	free(wide->d);
+	free(wide);
+	free(flt->d);
+	free(flt);
+
+	/* blending is the same on every pixel of a span, however it is
+	 * split between vector and scalar code */
+	gc_clear(gc);
+	cam.x = cam.y = 0;
+	cam.zoom = 2.5f;
+	gc_set_camera(gc, &cam);
+	gc_draw(gc, sprite, 20, 20, 0, 1, 0);
+	img = snap(gc, IMAGE_RGBA8);
+	pixel(img, 20, 23, ref);
+	assert(ref[0] > 120 && ref[0] < 135 && ref[1] == ref[0] && ref[2] == 255 && ref[3] == 255);
+	for (i = 21; i < 30; ++i) {
+		pixel(img, i, 23, px);
+		assert(!memcmp(px, ref, sizeof(px)));
+	}
+	free(img->d);
+	free(img);
+	gc_set_camera(gc, NULL);
+
+	/* sprites drawn right away go over the ones queued before */
+	gc_clear(gc);
+	gc_queue_push(gc, opaque, 20, 20, 0, 0, 0);
+	gc_draw(gc, opaque, 20, 20, 0, 1, 0);
+	gc_queue_submit(gc);
+	img = snap(gc, IMAGE_RGBA8);
+	pixel(img, 9, 10, px);
+	assert(px[0] == 0 && px[2] == 255);
+	free(img->d);
+	free(img);
+
+	/* depth testing keeps higher layers over lower ones whatever the
+	 * order of drawing */
+	gc_set_depth_test(gc, 1);
+	gc_clear(gc);
+	gc_queue_push(gc, opaque, 20, 20, 2, 0, 0);
+	gc_queue_submit(gc);
+	gc_queue_push(gc, opaque, 20, 20, 1, 1, 0);
+	gc_queue_submit(gc);
+	img = snap(gc, IMAGE_RGBA8);
+	pixel(img, 9, 10, px);
+	assert(px[0] == 255 && px[2] == 0);
+	free(img->d);
+	free(img);
+
+	/* and ties go to the sprite sorted last, as without depth testing */
+	for (i = 1; i >= 0; --i) {
+		gc_set_depth_test(gc, i);
+		gc_clear(gc);
+		gc_queue_push(gc, other, 20, 20, 1, 0, 0);
+		gc_queue_push(gc, opaque, 20, 20, 1, 1, 0);
+		gc_queue_submit(gc);
+		img = snap(gc, IMAGE_RGBA8);
+		pixel(img, 9, 10, px);
+		assert(px[0] == 255 && px[2] == 0);
+		free(img->d);
+		free(img);
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/log.h"
+#include "../src/ff.h"
+#include "../src/render.h"
+#include "../src/tilemap.h"
+
+#define TILE 6400
+#define WALL 7
+
+int
+main(void)
+{
+	Tilemap *tm;
+	size_t x, y;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	tm = tilemap_create(1000, 1000, 2, TILE, TILE);
+	assert(tm);
+	assert(tilemap_get(tm, 0, 999, 999) == TILE_EMPTY);
+	for (y = 0; y < 40; ++y)
+		for (x = 0; x < 40; ++x)
+			assert(tilemap_set(tm, 0, x, y, 1 + (x + y) % 3));
+	assert(tilemap_get(tm, 0, 39, 38) == 1 + 77 % 3);
+	assert(tilemap_get(tm, 1, 39, 38) == TILE_EMPTY);
+	assert(!tilemap_set(tm, 2, 0, 0, 1));
+	assert(!tilemap_set(tm, 0, 1000, 0, 1));
+
+	/* only solid tiles of any layer block boxes */
+	assert(tilemap_set(tm, 1, 500, 500, WALL));
+	tilemap_set_solid(tm, WALL, 1);
+	assert(!tilemap_collide(tm, 0, 0, 40 * TILE, 40 * TILE));
+	assert(tilemap_collide(tm, 500 * TILE, 500 * TILE, 1, 1));
+	assert(tilemap_collide(tm, 499 * TILE + 1, 499 * TILE + 1, TILE, TILE));
+	assert(!tilemap_collide(tm, 499 * TILE, 499 * TILE, TILE, TILE));
+	assert(!tilemap_collide(tm, -TILE, -TILE, TILE, TILE));
+	tilemap_set_solid(tm, WALL, 0);
+	assert(!tilemap_collide(tm, 500 * TILE, 500 * TILE, 1, 1));
+	tilemap_destroy(tm);
+
+	return 0;
+}
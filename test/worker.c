@@ -0,0 +1,116 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/log.h"
+#include "../src/worker.h"
+
+#define NJOBS 1000
+#define NBATCHES 64
+#define NWORKERS 4
+#define NBACKLOG 4000 /* far more than a queue starts with */
+
+typedef struct {
+	Workers *w;
+	int in[NBATCHES], out[NBATCHES];
+} Nested;
+
+static int squares[NJOBS];
+static int backlog[NBACKLOG];
+static pthread_t submitter;
+static pthread_mutex_t gate_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open, nblocked, ninline;
+
+static void
+block(void *ctx)
+{
+	pthread_mutex_lock(&gate_mtx);
+	++nblocked;
+	pthread_cond_broadcast(&gate_cond);
+	while (!gate_open)
+		pthread_cond_wait(&gate_cond, &gate_mtx);
+	pthread_mutex_unlock(&gate_mtx);
+}
+
+static void
+mark(void *ctx)
+{
+	pthread_mutex_lock(&gate_mtx);
+	if (!gate_open && pthread_equal(pthread_self(), submitter))
+		++ninline;
+	pthread_mutex_unlock(&gate_mtx);
+	*(int *)ctx = 1;
+}
+
+static void
+square(void *ctx)
+{
+	int *i;
+
+	i = ctx;
+	*i *= *i;
+}
+
+static void
+nested(void *ctx)
+{
+	Nested *n;
+	int i;
+
+	/* data-parallel loop run from within a job */
+	n = ctx;
+	for (i = 0; i < NBATCHES; ++i)
+		n->out[i] = n->in[i] = i;
+	workers_parallel_for(n->w, square, n->out, sizeof(int), NBATCHES);
+}
+
+int
+main(void)
+{
+	Workers *w;
+	Nested n;
+	int i;
+
+	log_add_fd_sink(1, LOGMSK_ALL ^ (LOGMSK_ERROR | LOGMSK_FATAL));
+	log_add_fd_sink(2, LOGMSK_ERROR | LOGMSK_FATAL);
+
+	w = workers_create(NWORKERS);
+	assert(w && workers_count(w) == NWORKERS);
+
+	for (i = 0; i < NJOBS; ++i)
+		squares[i] = i;
+	workers_parallel_for(w, square, squares, sizeof(int), NJOBS);
+	for (i = 0; i < NJOBS; ++i)
+		assert(squares[i] == i * i);
+
+	n.w = w;
+	workers_submit(w, nested, &n);
+	workers_wait(w);
+	for (i = 0; i < NBATCHES; ++i)
+		assert(n.out[i] == n.in[i] * n.in[i]);
+
+	/* a backlog piling up while all the workers are busy waits in the
+	 * queues instead of being run by the submitting thread */
+	submitter = pthread_self();
+	for (i = 0; i < NWORKERS; ++i)
+		workers_submit(w, block, NULL);
+	pthread_mutex_lock(&gate_mtx);
+	while (nblocked < NWORKERS)
+		pthread_cond_wait(&gate_cond, &gate_mtx);
+	pthread_mutex_unlock(&gate_mtx);
+	for (i = 0; i < NBACKLOG; ++i)
+		workers_submit(w, mark, &backlog[i]);
+	pthread_mutex_lock(&gate_mtx);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_mtx);
+	workers_wait(w);
+	assert(!ninline);
+	for (i = 0; i < NBACKLOG; ++i)
+		assert(backlog[i]);
+	workers_destroy(w);
+
+	return 0;
+}